@@ -31,15 +31,15 @@
 #include <fstream>
 #include <iomanip>
 
-#include <SDL2pp/Surface.hh>
-
 #include "collision.hh"
 
 constexpr SDL2pp::Rect Game::deposit_area_rect_;
 constexpr SDL2pp::Rect Game::play_area_rect_;
 constexpr SDL2pp::Rect Game::map_tiles_rect_;
 constexpr float Game::player_max_speed_;
+constexpr float Game::max_frame_time_;
 constexpr int Game::portal_effect_duration_ms_;
+constexpr int Game::cache_stats_refresh_ms_;
 
 Game::Game(SDL2pp::Renderer& renderer)
 	: renderer_(renderer),
@@ -47,29 +47,21 @@ Game::Game(SDL2pp::Renderer& renderer)
 	  player_texture_(renderer_, HOVERBOARD_DATADIR "/all-four.png"),
 	  player_texture_b_(renderer_, HOVERBOARD_DATADIR "/all-four-b.png"),
 	  player_texture_y_(renderer_, HOVERBOARD_DATADIR "/all-four-y.png"),
-	  minimap_texture_(renderer_, HOVERBOARD_DATADIR "/minimap.png"),
 	  map_icons_texture_(renderer_, HOVERBOARD_DATADIR "/map_icons.png"),
-	  font_10_(HOVERBOARD_DATADIR "/xkcd-Regular.otf", 10),
-	  font_18_(HOVERBOARD_DATADIR "/xkcd-Regular.otf", 18),
-	  font_20_(HOVERBOARD_DATADIR "/xkcd-Regular.otf", 20),
-	  font_34_(HOVERBOARD_DATADIR "/xkcd-Regular.otf", 34),
-	  font_40_(HOVERBOARD_DATADIR "/xkcd-Regular.otf", 40),
-	  arrowkeys_message_(renderer_, font_18_.RenderText_Blended("use the arrow keys to move, esc/q to quit", SDL_Color{ 255, 255, 255, 192 })),
-	  playarea_message_(renderer_, font_40_.RenderText_Blended("RETURN TO THE PLAY AREA", SDL_Color{ 255, 0, 0, 255 } )),
-	  map_numbers_{{
-		  SDL2pp::Texture(renderer_, font_10_.RenderText_Blended("0", SDL_Color{ 0, 87, 120, 192 })),
-		  SDL2pp::Texture(renderer_, font_10_.RenderText_Blended("1", SDL_Color{ 0, 87, 120, 192 })),
-		  SDL2pp::Texture(renderer_, font_10_.RenderText_Blended("2", SDL_Color{ 0, 87, 120, 192 })),
-		  SDL2pp::Texture(renderer_, font_10_.RenderText_Blended("3", SDL_Color{ 0, 87, 120, 192 })),
-		  SDL2pp::Texture(renderer_, font_10_.RenderText_Blended("4", SDL_Color{ 0, 87, 120, 192 })),
-		  SDL2pp::Texture(renderer_, font_10_.RenderText_Blended("5", SDL_Color{ 0, 87, 120, 192 })),
-		  SDL2pp::Texture(renderer_, font_10_.RenderText_Blended("6", SDL_Color{ 0, 87, 120, 192 })),
-		  SDL2pp::Texture(renderer_, font_10_.RenderText_Blended("7", SDL_Color{ 0, 87, 120, 192 })),
-		  SDL2pp::Texture(renderer_, font_10_.RenderText_Blended("8", SDL_Color{ 0, 87, 120, 192 })),
-		  SDL2pp::Texture(renderer_, font_10_.RenderText_Blended("9", SDL_Color{ 0, 87, 120, 192 }))
-	  }},
-	  tile_cache_(renderer) {
-	minimap_texture_.SetAlphaMod(192);
+	  font_10_(renderer_, HOVERBOARD_DATADIR "/xkcd-Regular.otf", 10),
+	  font_18_(renderer_, HOVERBOARD_DATADIR "/xkcd-Regular.otf", 18),
+	  font_20_(renderer_, HOVERBOARD_DATADIR "/xkcd-Regular.otf", 20),
+	  font_34_(renderer_, HOVERBOARD_DATADIR "/xkcd-Regular.otf", 34),
+	  font_40_(renderer_, HOVERBOARD_DATADIR "/xkcd-Regular.otf", 40),
+	  arrowkeys_message_("use the arrow keys to move, esc/q to quit"),
+	  playarea_message_("RETURN TO THE PLAY AREA"),
+	  loading_message_("Loading..."),
+	  map_numbers_{{ "0", "1", "2", "3", "4", "5", "6", "7", "8", "9" }},
+	  tile_cache_(renderer),
+	  coin_index_(coin_locations_) {
+	std::string minimap_cache_path = GetMinimapCachePath();
+	MakeParentDirs(minimap_cache_path);
+	minimap_builder_.reset(new MinimapBuilder(map_tiles_rect_, map_tile_size_, minimap_cache_path));
 }
 
 Game::~Game() {
@@ -83,12 +75,16 @@ void Game::ClearActionFlag(int flag) {
 	action_flags_ &= ~flag;
 }
 
-SDL2pp::Rect Game::GetCameraRect() const {
+SDL2pp::Rect Game::GetViewRect(float scale) const {
+	// world area seen on screen at given scale
+	int width = (int)((float)renderer_.GetOutputWidth() / scale);
+	int height = (int)((float)renderer_.GetOutputHeight() / scale);
+
 	SDL2pp::Rect rect(
-			(int)game_state_.player_x - renderer_.GetOutputWidth() / 2,
-			(int)game_state_.player_y - renderer_.GetOutputHeight() / 2,
-			renderer_.GetOutputWidth(),
-			renderer_.GetOutputHeight()
+			(int)game_state_.player_x - width / 2,
+			(int)game_state_.player_y - height / 2,
+			width,
+			height
 		);
 
 	if (rect.x < left_world_bound_)
@@ -99,6 +95,10 @@ SDL2pp::Rect Game::GetCameraRect() const {
 	return rect;
 }
 
+SDL2pp::Rect Game::GetCameraRect() const {
+	return GetViewRect(1.0f);
+}
+
 SDL2pp::Rect Game::GetPlayerRect(float x, float y) const {
 	return SDL2pp::Rect(
 			(int)x - player_width_ + player_width_ / 2,
@@ -143,9 +143,7 @@ SDL2pp::Point Game::GetPosOnMap(float x, float y) const {
 }
 
 void Game::Update(float delta_t, LoadingProgressCallback loadingcb) {
-	// don't allow too long frames which may leave player in the obstacle
-	// XXX: this shouldn't happen regardless of frame time
-	delta_t = std::min(delta_t, 1.0f / 60.0f);
+	delta_t = std::min(delta_t, max_frame_time_);
 
 	auto now = std::chrono::steady_clock::now();
 
@@ -199,38 +197,63 @@ void Game::Update(float delta_t, LoadingProgressCallback loadingcb) {
 	game_state_.player_yvel = std::max(-player_max_speed_, std::min(game_state_.player_yvel, player_max_speed_));
 
 	// Velocity updates caused by collisions
+	//
+	// Obstacles are probed along the whole distance player may cover
+	// in this frame, and velocities are limited so that the frame step
+	// (velocity * fps_correction) stops right at the obstacle, so
+	// longer frames can't carry player through walls
+	const int probe_distance = (int)std::ceil(player_max_speed_ * fps_correction);
+
 	CollisionInfo collisions_;
-	tile_cache_.UpdateCollisions(collisions_, GetPlayerCollisionRect(), (int)std::ceil(player_max_speed_));
+	tile_cache_.UpdateCollisions(collisions_, GetPlayerCollisionRect(), SDL2pp::Point(probe_distance, probe_distance), GetCameraRect());
 
 	if (collisions_.HasLeftCollision()) {
 		int dist_to_left = (collisions_.GetLeftCollision().x - GetPlayerCollisionRect().x + 1);
 		int step_height = GetPlayerCollisionRect().GetY2() - collisions_.GetLeftCollision().y + 1;
 
-		if (game_state_.player_xvel < -player_speed_epsilon_ && game_state_.player_xvel < -(float)dist_to_left && step_height <= max_step_height_ && game_state_.player_yvel * fps_correction > -step_height)
+		if (game_state_.player_xvel < -player_speed_epsilon_ && game_state_.player_xvel * fps_correction < -(float)dist_to_left && step_height <= max_step_height_ && game_state_.player_yvel * fps_correction > -step_height)
 			game_state_.player_yvel = -step_height / fps_correction;
 
-		game_state_.player_xvel = std::max(game_state_.player_xvel, (float)dist_to_left);
+		game_state_.player_xvel = std::max(game_state_.player_xvel, (float)dist_to_left / fps_correction);
 	}
 	if (collisions_.HasRightCollision()) {
 		int dist_to_right = collisions_.GetRightCollision().x - GetPlayerCollisionRect().GetX2() - 1;
 		int step_height = GetPlayerCollisionRect().GetY2() - collisions_.GetRightCollision().y + 1;
 
-		if (game_state_.player_xvel > -player_speed_epsilon_ && game_state_.player_xvel > (float)dist_to_right && step_height <= max_step_height_ && game_state_.player_yvel * fps_correction > -step_height)
+		if (game_state_.player_xvel > -player_speed_epsilon_ && game_state_.player_xvel * fps_correction > (float)dist_to_right && step_height <= max_step_height_ && game_state_.player_yvel * fps_correction > -step_height)
 			game_state_.player_yvel = -step_height / fps_correction;
 
-		game_state_.player_xvel = std::min(game_state_.player_xvel, (float)dist_to_right);
+		game_state_.player_xvel = std::min(game_state_.player_xvel, (float)dist_to_right / fps_correction);
 	}
 	if (collisions_.HasTopCollision()) {
 		int dist_to_top = collisions_.GetTopCollision() - GetPlayerCollisionRect().y + 1;
-		game_state_.player_yvel = std::max(game_state_.player_yvel, (float)dist_to_top);
+		game_state_.player_yvel = std::max(game_state_.player_yvel, (float)dist_to_top / fps_correction);
 	}
 	if (collisions_.HasBottomCollision()) {
 		int dist_to_bottom = collisions_.GetBottomCollision() - GetPlayerCollisionRect().GetY2() - 1;
-		game_state_.player_yvel = std::min(game_state_.player_yvel, (float)dist_to_bottom);
+		game_state_.player_yvel = std::min(game_state_.player_yvel, (float)dist_to_bottom / fps_correction);
 	}
 
 	// Update player position
+	//
+	// Step is swept as horizontal move followed by vertical one:
+	// the former is covered by the probe above, and vertical
+	// obstacles are probed again from where it ends, which covers
+	// the corner areas a long diagonal step could otherwise cut
 	game_state_.player_x += game_state_.player_xvel * fps_correction;
+
+	CollisionInfo vertical_collisions;
+	tile_cache_.UpdateCollisions(vertical_collisions, GetPlayerCollisionRect(), SDL2pp::Point(0, probe_distance), GetCameraRect());
+
+	if (vertical_collisions.HasTopCollision()) {
+		int dist_to_top = vertical_collisions.GetTopCollision() - GetPlayerCollisionRect().y + 1;
+		game_state_.player_yvel = std::max(game_state_.player_yvel, (float)dist_to_top / fps_correction);
+	}
+	if (vertical_collisions.HasBottomCollision()) {
+		int dist_to_bottom = vertical_collisions.GetBottomCollision() - GetPlayerCollisionRect().GetY2() - 1;
+		game_state_.player_yvel = std::min(game_state_.player_yvel, (float)dist_to_bottom / fps_correction);
+	}
+
 	game_state_.player_y += game_state_.player_yvel * fps_correction;
 
 	if (action_flags_)
@@ -269,9 +292,10 @@ void Game::Update(float delta_t, LoadingProgressCallback loadingcb) {
 		game_state_.is_in_deposit_area = false;
 
 		// Collect coins (only if not in deposit area)
-		for (size_t ncoin = 0; ncoin < coin_locations_.size(); ncoin++)
-			if (!game_state_.picked_coins[ncoin] && player_rect.Intersects(GetCoinRect(coin_locations_[ncoin])))
-				game_state_.picked_coins[ncoin] = true;
+		coin_index_.ProcessPointsInRect(player_rect.GetExtension(coin_size_), [&](size_t ncoin) {
+				if (!game_state_.picked_coins[ncoin] && player_rect.Intersects(GetCoinRect(coin_locations_[ncoin])))
+					game_state_.picked_coins[ncoin] = true;
+			});
 	}
 
 	// Handle player leaving play area
@@ -288,31 +312,67 @@ void Game::Update(float delta_t, LoadingProgressCallback loadingcb) {
 			return e.start + std::chrono::milliseconds(portal_effect_duration_ms_) < now;
 		});
 
-	// Update tile cache
-	tile_cache_.UpdateCache(GetCameraRect(), 512, 512, loadingcb);
+	// Update tile cache, prefetching in the direction of player movement
+	SDL2pp::Point lookahead(
+			(int)(game_state_.player_xvel * tile_prefetch_lookahead_frames_),
+			(int)(game_state_.player_yvel * tile_prefetch_lookahead_frames_)
+		);
+	tile_cache_.UpdateCache(GetCameraRect(), tile_precache_distance_, tile_precache_distance_, lookahead, loadingcb);
+	tile_cache_.UpdateObstacleCache(GetPlayerRect(), obstacle_precache_distance_, lookahead);
+	tile_cache_.UpdateLevelCache(GetViewRect(camera_scale_), camera_scale_);
+
+	if (show_cache_stats_ && now >= cache_stats_refresh_) {
+		UpdateCacheStats();
+		cache_stats_refresh_ = now + std::chrono::milliseconds(cache_stats_refresh_ms_);
+	}
 
 	// Update seen things
-	tile_cache_.ProcessTilesInRect(GetCameraRect(), [this](const SDL2pp::Point& tilecoord) {
-			if (map_tiles_rect_.Contains(tilecoord))
-				game_state_.seen_tiles[tilecoord.x - map_tiles_rect_.x + (tilecoord.y - map_tiles_rect_.y) * map_tiles_rect_.w] = true;
+	SDL2pp::Rect camerarect = GetCameraRect();
+	tile_cache_.ProcessTilesInRect(camerarect, [this](const SDL2pp::Point& tilecoord) {
+			if (!map_tiles_rect_.Contains(tilecoord))
+				return;
+
+			SDL2pp::Point maptile = tilecoord - map_tiles_rect_.GetTopLeft();
+			size_t ntile = maptile.x + maptile.y * map_tiles_rect_.w;
+			if (!game_state_.seen_tiles[ntile]) {
+				game_state_.seen_tiles[ntile] = true;
+				RevealMinimapTile(maptile.x, maptile.y);
+			}
+		});
+	coin_index_.ProcessPointsInRect(camerarect.GetExtension(coin_size_), [&](size_t ncoin) {
+			if (camerarect.Intersects(GetCoinRect(coin_locations_[ncoin])))
+				game_state_.seen_coins[ncoin] = true;
 		});
-	for (size_t ncoin = 0; ncoin < coin_locations_.size(); ncoin++)
-		if (GetCameraRect().Intersects(GetCoinRect(coin_locations_[ncoin])))
-			game_state_.seen_coins[ncoin] = true;
+
+	// Pick up minimap once it's built
+	if (minimap_builder_ && minimap_builder_->IsReady()) {
+		minimap_texture_ = SDL2pp::Texture(renderer_, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STATIC, minimap_builder_->GetWidth(), minimap_builder_->GetHeight());
+		minimap_texture_->SetBlendMode(SDL_BLENDMODE_BLEND);
+		minimap_texture_->SetAlphaMod(192);
+		minimap_pixels_ = minimap_builder_->GetPixels();
+		minimap_builder_.reset();
+
+		RefreshMinimap();
+	}
 
 	prev_action_flags_ = action_flags_;
 }
 
 void Game::Render() {
 	SDL2pp::Rect camerarect = GetCameraRect();
+	SDL2pp::Rect viewrect = GetViewRect(camera_scale_);
 	auto now = std::chrono::steady_clock::now();
 
-	tile_cache_.Render(camerarect);
+	// world is drawn in world pixels, scaled by renderer
+	renderer_.SetScale(camera_scale_, camera_scale_);
+
+	tile_cache_.Render(viewrect, camera_scale_);
 
 	// draw coins
-	for (size_t ncoin = 0; ncoin < coin_locations_.size(); ncoin++)
-		if (!game_state_.picked_coins[ncoin])
-			renderer_.Copy(coin_texture_, SDL2pp::NullOpt, GetCoinRect(coin_locations_[ncoin]) - SDL2pp::Point(camerarect.x, camerarect.y));
+	coin_index_.ProcessPointsInRect(viewrect.GetExtension(coin_size_), [&](size_t ncoin) {
+			if (!game_state_.picked_coins[ncoin])
+				renderer_.Copy(coin_texture_, SDL2pp::NullOpt, GetCoinRect(coin_locations_[ncoin]) - SDL2pp::Point(viewrect.x, viewrect.y));
+		});
 
 	// draw portal effects
 	for (auto& effect : portal_effects_) {
@@ -343,7 +403,7 @@ void Game::Render() {
 		renderer_.Copy(
 				*texture,
 				SDL2pp::Rect(rect.w * (int)effect.player_state, 0, rect.w, rect.h),
-				rect.GetExtension(-player_rect_shrink + (int)effect_shrink, (int)effect_shrink) - SDL2pp::Point(camerarect.x, camerarect.y),
+				rect.GetExtension(-player_rect_shrink + (int)effect_shrink, (int)effect_shrink) - SDL2pp::Point(viewrect.x, viewrect.y),
 				0.0f,
 				SDL2pp::NullOpt,
 				flipflag);
@@ -358,51 +418,61 @@ void Game::Render() {
 		renderer_.Copy(
 				player_texture_,
 				SDL2pp::Rect(GetPlayerRect().w * (int)game_state_.player_state, 0, GetPlayerRect().w, GetPlayerRect().h),
-				GetPlayerRect().GetExtension(-player_rect_shrink, 0) - SDL2pp::Point(camerarect.x, camerarect.y),
+				GetPlayerRect().GetExtension(-player_rect_shrink, 0) - SDL2pp::Point(viewrect.x, viewrect.y),
 				0.0f,
 				SDL2pp::NullOpt,
 				flipflag);
 	}
 
+	renderer_.SetScale(1.0f, 1.0f);
+
 	// draw messages
 	if (now < game_state_.deposit_message_expiration) {
-		if (deposit_big_message_) {
+		if (!deposit_big_message_.empty()) {
+			SDL2pp::Point size = font_34_.GetSize(deposit_big_message_);
 			SDL2pp::Point pos(
-					camerarect.w / 2 - deposit_big_message_->GetWidth() / 2,
-					camerarect.h - deposit_big_message_->GetHeight() - 46
+					camerarect.w / 2 - size.x / 2,
+					camerarect.h - size.y - 46
 				);
 
-			renderer_.Copy(*deposit_big_message_, SDL2pp::NullOpt, pos);
+			font_34_.Render(deposit_big_message_, pos, SDL_Color{ 0xee, 0xd0, 0x00, 0xff });
 		}
-		if (deposit_small_message_) {
+		if (!deposit_small_message_.empty()) {
+			// In browser variant, this message is rendered with 26 size font, however
+			// while browser renders letters as small caps (haven't checked, but I
+			// assume this font doesn't have small letters), SDL_ttf renders them
+			// as normal caps. Thus with SDL_ttf we have to take smaller font
+			SDL2pp::Point size = font_20_.GetSize(deposit_small_message_);
 			SDL2pp::Point pos(
-					camerarect.w / 2 - deposit_small_message_->GetWidth() / 2,
-					camerarect.h - deposit_small_message_->GetHeight() - 20
+					camerarect.w / 2 - size.x / 2,
+					camerarect.h - size.y - 20
 				);
 
-			renderer_.Copy(*deposit_small_message_, SDL2pp::NullOpt, pos);
+			font_20_.Render(deposit_small_message_, pos, SDL_Color{ 0xee, 0xd0, 0x00, 0xff });
 		}
 	}
 
 	if (!game_state_.player_moved) {
+		SDL2pp::Point size = font_18_.GetSize(arrowkeys_message_);
 		SDL2pp::Point pos(
-				camerarect.w / 2 - arrowkeys_message_.GetWidth() / 2,
-				camerarect.h - arrowkeys_message_.GetHeight() - 20
+				camerarect.w / 2 - size.x / 2,
+				camerarect.h - size.y - 20
 			);
 
-		renderer_.Copy(arrowkeys_message_, SDL2pp::NullOpt, pos);
+		font_18_.Render(arrowkeys_message_, pos, SDL_Color{ 255, 255, 255, 192 });
 	}
 
 	if (!game_state_.is_in_play_area) {
 		auto msec_since_escape = std::chrono::duration_cast<std::chrono::milliseconds>(now - game_state_.playarea_leave_moment).count();
 
 		if (msec_since_escape < 5 * 2500 && msec_since_escape % 2500 < 1500 && msec_since_escape % 500 < 250) {
+			SDL2pp::Point size = font_40_.GetSize(playarea_message_);
 			SDL2pp::Point pos(
-					camerarect.w / 2 - playarea_message_.GetWidth() / 2,
-					camerarect.h - playarea_message_.GetHeight() - 20
+					camerarect.w / 2 - size.x / 2,
+					camerarect.h - size.y - 20
 				);
 
-			renderer_.Copy(playarea_message_, SDL2pp::NullOpt, pos);
+			font_40_.Render(playarea_message_, pos, SDL_Color{ 255, 0, 0, 255 });
 		}
 	}
 
@@ -413,20 +483,9 @@ void Game::Render() {
 
 		SDL2pp::Point map_center_on_screen = GetCameraRect().GetSize() / SDL2pp::Point(2, 3);
 
-		for (int y = 0; y < map_tiles_rect_.h; y++) {
-			for (int x = 0; x < map_tiles_rect_.w; x++) {
-				// XXX: instead of rendering individual map squares we may render contiguous strips here
-				if (game_state_.seen_tiles[x + y * map_tiles_rect_.w]) {
-					SDL2pp::Point target = map_center_on_screen - map_pos + SDL2pp::Point(x, y) * (map_tile_size_);
-
-					renderer_.Copy(
-							minimap_texture_,
-							SDL2pp::Rect(x * map_tile_size_, y * map_tile_size_, map_tile_size_, map_tile_size_),
-							target
-						);
-				}
-			}
-		}
+		// texture only has seen tiles, rest is transparent
+		if (minimap_texture_)
+			renderer_.Copy(*minimap_texture_, SDL2pp::NullOpt, map_center_on_screen - map_pos);
 
 		// coin icons
 		for (size_t ncoin = 0; ncoin < coin_locations_.size(); ncoin++) {
@@ -443,10 +502,10 @@ void Game::Render() {
 		for (int nloc = 0; nloc < num_saved_locations_; nloc++) {
 			auto& loc = game_state_.saved_locations[nloc];
 			if (loc) {
-				renderer_.Copy(
+				font_10_.Render(
 						map_numbers_[nloc],
-						SDL2pp::NullOpt,
-						map_center_on_screen + GetPosOnMap(loc->first, loc->second) - map_player_pos - SDL2pp::Point(map_numbers_[nloc].GetWidth() / 2, map_numbers_[nloc].GetHeight() / 2)
+						map_center_on_screen + GetPosOnMap(loc->first, loc->second) - map_player_pos - font_10_.GetSize(map_numbers_[nloc]) / 2,
+						SDL_Color{ 0, 87, 120, 192 }
 					);
 			}
 		}
@@ -458,6 +517,19 @@ void Game::Render() {
 				map_center_on_screen - SDL2pp::Point(map_icon_size_ / 2, map_icon_size_ / 2)
 			);
 	}
+
+	// cache statistics
+	if (show_cache_stats_) {
+		SDL2pp::Point pos(5, 5);
+		for (const auto& line : cache_stats_lines_) {
+			font_18_.Render(line, pos, SDL_Color{ 0, 0, 0, 255 });
+			pos.y += font_18_.GetSize(line).y;
+		}
+	}
+}
+
+void Game::InvalidateRenderCache() {
+	tile_cache_.InvalidateRenderCache();
 }
 
 void Game::RenderProgressbar(int ndone, int ntotal) {
@@ -477,8 +549,78 @@ void Game::RenderProgressbar(int ndone, int ntotal) {
 	renderer_.SetDrawColor(255, 255, 255);
 	renderer_.FillRect(pbrect);
 
-	SDL2pp::Texture text(renderer_, font_34_.RenderText_Blended("Loading...", SDL_Color{ 0x0, 0x0, 0x0, 0xff }));
-	renderer_.Copy(text, SDL2pp::NullOpt, SDL2pp::Point(renderer_.GetOutputWidth() / 2 - text.GetWidth() / 2, renderer_.GetOutputHeight() / 2 - bar_height / 2 - text.GetHeight()));
+	SDL2pp::Point text_size = font_34_.GetSize(loading_message_);
+	font_34_.Render(loading_message_, SDL2pp::Point(renderer_.GetOutputWidth() / 2 - text_size.x / 2, renderer_.GetOutputHeight() / 2 - bar_height / 2 - text_size.y), SDL_Color{ 0x0, 0x0, 0x0, 0xff });
+}
+
+void Game::RevealMinimapTile(int x, int y) {
+	if (!minimap_texture_)
+		return;
+
+	// pixel data for the tile is taken right from complete minimap
+	SDL2pp::Rect rect(x * map_tile_size_, y * map_tile_size_, map_tile_size_, map_tile_size_);
+	minimap_texture_->Update(rect, minimap_pixels_.data() + rect.y * minimap_texture_->GetWidth() + rect.x, minimap_texture_->GetWidth() * 4);
+}
+
+void Game::RefreshMinimap() {
+	if (!minimap_texture_)
+		return;
+
+	// compose whole texture at once, as there may be thousands
+	// of seen tiles, which we don't want to upload one by one
+	const int width = minimap_texture_->GetWidth();
+	MinimapBuilder::Pixels pixels(minimap_pixels_.size(), 0);
+
+	for (int y = 0; y < map_tiles_rect_.h; y++) {
+		for (int x = 0; x < map_tiles_rect_.w; x++) {
+			if (!game_state_.seen_tiles[x + y * map_tiles_rect_.w])
+				continue;
+
+			for (int row = y * map_tile_size_; row < (y + 1) * map_tile_size_; row++) {
+				size_t offset = row * width + x * map_tile_size_;
+				std::copy(minimap_pixels_.begin() + offset, minimap_pixels_.begin() + offset + map_tile_size_, pixels.begin() + offset);
+			}
+		}
+	}
+
+	minimap_texture_->Update(SDL2pp::NullOpt, pixels.data(), width * 4);
+}
+
+void Game::UpdateCacheStats() {
+	cache_stats_lines_.clear();
+
+	{
+		std::stringstream line;
+		line << "TILES " << (tile_cache_.GetCpuBytes() >> 10) << " KB, TEXTURES " << (tile_cache_.GetTextureBytes() >> 10) << " KB";
+		cache_stats_lines_.push_back(line.str());
+	}
+
+	{
+		std::stringstream line;
+		line << "EVICTED " << (tile_cache_.GetEvictedBytes() >> 10) << " KB, OBSTACLES " << (tile_cache_.GetObstacleBytes() >> 10) << " KB, LEVELS " << (tile_cache_.GetLevelBytes() >> 10) << " KB";
+		cache_stats_lines_.push_back(line.str());
+	}
+
+	{
+		const TexturePool::Stats& pool = tile_cache_.GetTexturePoolStats();
+		std::stringstream line;
+		line << "TEXTURE POOL " << pool.in_use << " IN USE (PEAK " << pool.peak_in_use << "), " << pool.idle << " IDLE, "
+			<< pool.created << " CREATED, " << pool.reused << " REUSED, " << pool.discarded << " DISCARDED";
+		cache_stats_lines_.push_back(line.str());
+	}
+
+	{
+		std::stringstream line;
+		line << "UPLOAD " << (int)tile_cache_.GetUpgradeCost() << " US PER TILE";
+		cache_stats_lines_.push_back(line.str());
+	}
+
+	{
+		TileCache::LoaderStats loader = tile_cache_.GetLoaderStats();
+		std::stringstream line;
+		line << "LOADS " << loader.loaded << " DONE, " << loader.cancelled << " CANCELLED (" << (int)loader.cancelled_ms << " MS WASTED)";
+		cache_stats_lines_.push_back(line.str());
+	}
 }
 
 void Game::DepositCoins() {
@@ -497,7 +639,7 @@ void Game::DepositCoins() {
 		if (seconds != 1)
 			message << "S";
 
-		deposit_big_message_.reset(new SDL2pp::Texture(renderer_, font_34_.RenderText_Blended(message.str(), SDL_Color{ 0xee, 0xd0, 0x00, 0xff } )));
+		deposit_big_message_ = message.str();
 	}
 
 	{
@@ -518,14 +660,7 @@ void Game::DepositCoins() {
 		else if (numcoins == coin_locations_.size())
 			message = "are you gandalf?";
 
-		// In browser variant, this message is rendered with 26 size font, however
-		// while browser renders letters as small caps (haven't checked, but I
-		// assume this font doesn't have small letters), SDL_ttf renders them
-		// as normal caps. Thus with SDL_ttf we have to take smaller font
-		if (!message.empty())
-			deposit_small_message_.reset(new SDL2pp::Texture(renderer_, font_20_.RenderText_Blended(message, SDL_Color{ 0xee, 0xd0, 0x00, 0xff } )));
-		else
-			deposit_small_message_.reset(nullptr);
+		deposit_small_message_ = message;
 	}
 
 	std::fill(game_state_.picked_coins.begin(), game_state_.picked_coins.end(), false);
@@ -553,10 +688,13 @@ std::string Game::GetStatePath() {
 	return "hoverboard.state";
 }
 
-void Game::SaveState() const {
+std::string Game::GetMinimapCachePath() {
+	// kept next to the state file
 	std::string path = GetStatePath();
+	return path.substr(0, path.rfind('/') + 1) + "minimap.cache";
+}
 
-	// make directories
+void Game::MakeParentDirs(const std::string& path) {
 	size_t slashpos = 0;
 
 	while ((slashpos = path.find('/', slashpos)) != std::string::npos) {
@@ -569,6 +707,12 @@ void Game::SaveState() const {
 		}
 		slashpos++;
 	}
+}
+
+void Game::SaveState() const {
+	std::string path = GetStatePath();
+
+	MakeParentDirs(path);
 
 	// save state
 	std::ofstream statefile(path, std::ios::out | std::ios::trunc | std::ios::out);
@@ -703,6 +847,8 @@ void Game::LoadState() {
 	}
 
 	game_state_ = new_state;
+
+	RefreshMinimap();
 }
 
 void Game::SaveLocation(int n) {
@@ -754,3 +900,16 @@ void Game::JumpToLocation(int n) {
 void Game::ToggleMinimap() {
 	show_minimap_ = !show_minimap_;
 }
+
+void Game::ToggleCacheStats() {
+	show_cache_stats_ = !show_cache_stats_;
+	cache_stats_refresh_ = std::chrono::steady_clock::time_point();  // refresh right away
+}
+
+void Game::ZoomIn() {
+	camera_scale_ = std::min(camera_scale_ * 2.0f, 1.0f);
+}
+
+void Game::ZoomOut() {
+	camera_scale_ = std::max(camera_scale_ / 2.0f, min_camera_scale_);
+}
@@ -28,11 +28,14 @@
 #include <memory>
 #include <array>
 
+#include <SDL2pp/Optional.hh>
 #include <SDL2pp/Rect.hh>
 #include <SDL2pp/Texture.hh>
 #include <SDL2pp/Renderer.hh>
-#include <SDL2pp/Font.hh>
 
+#include "glyphatlas.hh"
+#include "minimap.hh"
+#include "pointindex.hh"
 #include "tilecache.hh"
 
 class Game {
@@ -89,6 +92,18 @@ private:
 
 	constexpr static int max_step_height_ = 5;
 
+	// collisions are swept over the whole frame step, so this only
+	// bounds the step after stalls (such as window being dragged)
+	constexpr static float max_frame_time_ = 0.25f;
+
+	// zooming out only affects the view, e.g. what counts as seen
+	// is still decided by the 1:1 camera rect
+	constexpr static float min_camera_scale_ = 0.125f;
+
+	constexpr static int tile_precache_distance_ = 1024;
+	constexpr static int obstacle_precache_distance_ = 2048;
+	constexpr static float tile_prefetch_lookahead_frames_ = 30.0f;
+
 	constexpr static SDL2pp::Rect deposit_area_rect_ = SDL2pp::Rect::FromCorners(512257, -549650, 512309, -549584);
 	constexpr static SDL2pp::Rect play_area_rect_ = SDL2pp::Rect::FromCorners(511484, -550619, 513026, -549568);
 
@@ -97,6 +112,8 @@ private:
 	constexpr static int portal_effect_duration_ms_ = 500;
 	constexpr static int portal_effect_size_ = 10;
 
+	constexpr static int cache_stats_refresh_ms_ = 1000;
+
 	constexpr static int map_tile_size_ = 8;
 	constexpr static int map_icon_size_ = 5;
 
@@ -117,23 +134,29 @@ private:
 	SDL2pp::Texture player_texture_;
 	SDL2pp::Texture player_texture_b_;
 	SDL2pp::Texture player_texture_y_;
-	SDL2pp::Texture minimap_texture_;
+	SDL2pp::Optional<SDL2pp::Texture> minimap_texture_;  // empty until built; only has seen tiles
 	SDL2pp::Texture map_icons_texture_;
-	SDL2pp::Font font_10_;
-	SDL2pp::Font font_18_;
-	SDL2pp::Font font_20_;
-	SDL2pp::Font font_34_;
-	SDL2pp::Font font_40_;
+	GlyphAtlas font_10_;
+	GlyphAtlas font_18_;
+	GlyphAtlas font_20_;
+	GlyphAtlas font_34_;
+	GlyphAtlas font_40_;
 
-	SDL2pp::Texture arrowkeys_message_;
-	SDL2pp::Texture playarea_message_;
-	std::array<SDL2pp::Texture, num_saved_locations_> map_numbers_;
+	const std::string arrowkeys_message_;
+	const std::string playarea_message_;
+	const std::string loading_message_;
+	std::array<std::string, num_saved_locations_> map_numbers_;
 
-	std::unique_ptr<SDL2pp::Texture> deposit_big_message_;
-	std::unique_ptr<SDL2pp::Texture> deposit_small_message_;
+	std::string deposit_big_message_;    // empty if none
+	std::string deposit_small_message_;  // empty if none
 
 	TileCache tile_cache_;
 
+	PointIndex coin_index_;  // coin_locations_ by tile
+
+	std::unique_ptr<MinimapBuilder> minimap_builder_;
+	MinimapBuilder::Pixels minimap_pixels_;  // complete minimap, revealed into texture as tiles are seen
+
 	// Controls
 	int action_flags_ = 0;
 	int prev_action_flags_ = 0;
@@ -158,6 +181,10 @@ private:
 	std::list<PortalEffect> portal_effects_;
 
 	bool show_minimap_ = false;
+	bool show_cache_stats_ = false;
+	std::vector<std::string> cache_stats_lines_;
+	std::chrono::steady_clock::time_point cache_stats_refresh_;
+	float camera_scale_ = 1.0f;
 	std::set<SDL2pp::Point> seen_tiles_;
 
 	// Game state
@@ -201,7 +228,10 @@ private:
 
 private:
 	static std::string GetStatePath();
+	static std::string GetMinimapCachePath();
+	static void MakeParentDirs(const std::string& path);
 
+	SDL2pp::Rect GetViewRect(float scale) const;
 	SDL2pp::Rect GetCameraRect() const;
 	SDL2pp::Rect GetPlayerRect(float x, float y) const;
 	SDL2pp::Rect GetPlayerRect() const;
@@ -210,6 +240,11 @@ private:
 
 	SDL2pp::Point GetPosOnMap(float x, float y) const;
 
+	void RevealMinimapTile(int x, int y);
+	void RefreshMinimap();
+
+	void UpdateCacheStats();
+
 	void DepositCoins();
 
 public:
@@ -225,6 +260,9 @@ public:
 	void Update(float delta_t, LoadingProgressCallback loadingcb = LoadingProgressCallback());
 	void Render();
 
+	// should be called when render targets are lost
+	void InvalidateRenderCache();
+
 	void RenderProgressbar(int ndone, int ntotal);
 
 	void LoadState();
@@ -234,6 +272,10 @@ public:
 	void JumpToLocation(int n);
 
 	void ToggleMinimap();
+	void ToggleCacheStats();
+
+	void ZoomIn();
+	void ZoomOut();
 };
 
 #endif // GAME_HH
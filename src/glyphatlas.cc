@@ -0,0 +1,139 @@
+/*
+ * Copyright (C) 2015 Dmitry Marakasov <amdmi3@amdmi3.ru>
+ *
+ * This file is part of hoverboard-sdl.
+ *
+ * hoverboard-sdl is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * hoverboard-sdl is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with hoverboard-sdl.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "glyphatlas.hh"
+
+#include <algorithm>
+
+#include <SDL2pp/Surface.hh>
+
+constexpr char GlyphAtlas::first_char_;
+constexpr char GlyphAtlas::last_char_;
+constexpr int GlyphAtlas::atlas_width_;
+constexpr size_t GlyphAtlas::max_layouts_;
+
+GlyphAtlas::GlyphAtlas(SDL2pp::Renderer& renderer, const std::string& path, int size)
+	: renderer_(renderer),
+	  font_(path, size) {
+}
+
+void GlyphAtlas::Build() {
+	// pack glyph images into rows; sizes are known without
+	// rasterizing, so the atlas is allocated just once
+	SDL2pp::Point pen(0, 0);
+	int row_height = 0;
+	for (char ch = first_char_; ch <= last_char_; ch++) {
+		Glyph& glyph = glyphs_[ch - first_char_];
+
+		if (!font_.IsGlyphProvided((unsigned char)ch))
+			continue;
+
+		glyph.advance = font_.GetGlyphAdvance((unsigned char)ch);
+
+		auto glyph_rect = font_.GetGlyphRect((unsigned char)ch);
+		if (!glyph_rect || glyph_rect->w <= 0 || glyph_rect->h <= 0)
+			continue;
+
+		// glyph image is the same as rendered text of a single
+		// character, which is shifted if glyph extends to the left
+		SDL2pp::Point image_size = font_.GetSizeText(std::string(1, ch));
+		if (pen.x + image_size.x > atlas_width_) {
+			pen.x = 0;
+			pen.y += row_height + 1;
+			row_height = 0;
+		}
+
+		glyph.rect = SDL2pp::Rect(pen, image_size);
+		glyph.offset = std::min(0, glyph_rect->x);
+
+		pen.x += image_size.x + 1; // padding against filtering bleed
+		row_height = std::max(row_height, image_size.y);
+	}
+
+	SDL2pp::Surface atlas(0, atlas_width_, std::max(1, pen.y + row_height), 32, 0x00ff0000, 0x0000ff00, 0x000000ff, 0xff000000);
+
+	for (char ch = first_char_; ch <= last_char_; ch++) {
+		const Glyph& glyph = glyphs_[ch - first_char_];
+		if (glyph.rect.w <= 0)
+			continue;
+
+		// copy alpha as is instead of blending onto empty atlas
+		SDL2pp::Surface image = font_.RenderText_Blended(std::string(1, ch), SDL_Color{ 255, 255, 255, 255 });
+		image.SetBlendMode(SDL_BLENDMODE_NONE);
+		image.Blit(SDL2pp::NullOpt, atlas, glyph.rect);
+	}
+
+	texture_ = SDL2pp::Texture(renderer_, atlas);
+	texture_->SetBlendMode(SDL_BLENDMODE_BLEND);
+}
+
+const GlyphAtlas::Layout& GlyphAtlas::GetLayout(const std::string& text) {
+	auto cached = layouts_.find(text);
+	if (cached != layouts_.end())
+		return cached->second;
+
+	if (!texture_)
+		Build();
+
+	// messages which include changing numbers would otherwise
+	// grow the cache indefinitely
+	if (layouts_.size() >= max_layouts_)
+		layouts_.clear();
+
+	Layout layout;
+	layout.size.y = font_.GetHeight();
+
+	int pen = 0;
+	char prev_ch = 0;
+	for (char ch : text) {
+		if (ch < first_char_ || ch > last_char_)
+			continue;
+
+		const Glyph& glyph = glyphs_[ch - first_char_];
+
+		if (prev_ch)
+			pen += font_.GetKerningSize((unsigned char)prev_ch, (unsigned char)ch);
+
+		if (glyph.rect.w > 0) {
+			layout.quads.push_back(Quad{ glyph.rect, SDL2pp::Point(pen + glyph.offset, 0) });
+			layout.size.x = std::max(layout.size.x, pen + glyph.offset + glyph.rect.w);
+		}
+
+		pen += glyph.advance;
+		prev_ch = ch;
+	}
+
+	layout.size.x = std::max(layout.size.x, pen);
+
+	return layouts_.emplace(text, std::move(layout)).first->second;
+}
+
+SDL2pp::Point GlyphAtlas::GetSize(const std::string& text) {
+	return GetLayout(text).size;
+}
+
+void GlyphAtlas::Render(const std::string& text, const SDL2pp::Point& pos, const SDL_Color& color) {
+	const Layout& layout = GetLayout(text);
+
+	texture_->SetColorMod(color.r, color.g, color.b);
+	texture_->SetAlphaMod(color.a);
+
+	for (auto& quad : layout.quads)
+		renderer_.Copy(*texture_, quad.src, pos + quad.dst);
+}
@@ -0,0 +1,88 @@
+/*
+ * Copyright (C) 2015 Dmitry Marakasov <amdmi3@amdmi3.ru>
+ *
+ * This file is part of hoverboard-sdl.
+ *
+ * hoverboard-sdl is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * hoverboard-sdl is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with hoverboard-sdl.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef GLYPHATLAS_HH
+#define GLYPHATLAS_HH
+
+#include <array>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <SDL2pp/Font.hh>
+#include <SDL2pp/Optional.hh>
+#include <SDL2pp/Point.hh>
+#include <SDL2pp/Rect.hh>
+#include <SDL2pp/Renderer.hh>
+#include <SDL2pp/Texture.hh>
+
+// Text rendering from a texture atlas of font glyphs
+//
+// Printable ASCII glyphs are rasterized once, in white, on first
+// use and packed into a single texture; text is then drawn as a
+// series of copies from it, tinted with color modulation. Glyph
+// positions for each distinct string are computed once and cached.
+class GlyphAtlas {
+private:
+	struct Glyph {
+		SDL2pp::Rect rect;  // in atlas; empty for blank glyphs
+		int offset = 0;     // of glyph image relative to pen position
+		int advance = 0;
+	};
+
+	struct Quad {
+		SDL2pp::Rect src;
+		SDL2pp::Point dst;  // relative to text origin
+	};
+
+	struct Layout {
+		std::vector<Quad> quads;
+		SDL2pp::Point size;
+	};
+
+	static constexpr char first_char_ = ' ';
+	static constexpr char last_char_ = '~';
+	static constexpr int atlas_width_ = 512;
+	static constexpr size_t max_layouts_ = 256;
+
+private:
+	SDL2pp::Renderer& renderer_;
+	SDL2pp::Font font_;
+
+	SDL2pp::Optional<SDL2pp::Texture> texture_;  // empty until first use
+	std::array<Glyph, last_char_ - first_char_ + 1> glyphs_;
+
+	std::unordered_map<std::string, Layout> layouts_;
+
+private:
+	void Build();
+	const Layout& GetLayout(const std::string& text);
+
+public:
+	GlyphAtlas(SDL2pp::Renderer& renderer, const std::string& path, int size);
+
+	GlyphAtlas(const GlyphAtlas&) = delete;
+	GlyphAtlas& operator=(const GlyphAtlas&) = delete;
+
+	// characters outside of printable ASCII are skipped
+	SDL2pp::Point GetSize(const std::string& text);
+	void Render(const std::string& text, const SDL2pp::Point& pos, const SDL_Color& color);
+};
+
+#endif // GLYPHATLAS_HH
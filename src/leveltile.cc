@@ -0,0 +1,87 @@
+/*
+ * Copyright (C) 2015 Dmitry Marakasov <amdmi3@amdmi3.ru>
+ *
+ * This file is part of hoverboard-sdl.
+ *
+ * hoverboard-sdl is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * hoverboard-sdl is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with hoverboard-sdl.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "leveltile.hh"
+
+#include "texturepool.hh"
+#include "tile.hh"
+
+constexpr int LevelTile::max_level_;
+
+LevelTile::LevelTile(int level, const SDL2pp::Point& coords, Pixels&& pixels)
+	: level_(level),
+	  coords_(coords),
+	  pixels_(std::move(pixels)) {
+}
+
+LevelTile::~LevelTile() {
+	if (texture_)
+		pool_->Release(std::move(*texture_));
+}
+
+int LevelTile::LevelForScale(float scale) {
+	// coarsest level which still has at least one texel per screen pixel
+	int level = 0;
+	while (level < max_level_ && scale * (float)(2 << level) <= 1.0f)
+		level++;
+	return level;
+}
+
+SDL2pp::Point LevelTile::CoordsForPoint(int level, const SDL2pp::Point& p) {
+	SDL2pp::Point tilecoord = Tile::CoordsForPoint(p);
+	return SDL2pp::Point(tilecoord.x >> level, tilecoord.y >> level); // arithmetic shift floors negatives
+}
+
+SDL2pp::Rect LevelTile::RectForCoords(int level, const SDL2pp::Point& coords) {
+	int size = Tile::tile_size_ << level;
+	return SDL2pp::Rect(coords.x * size, coords.y * size, size, size);
+}
+
+SDL2pp::Rect LevelTile::GetRect() const {
+	return RectForCoords(level_, coords_);
+}
+
+size_t LevelTile::GetCpuBytes() const {
+	return sizeof(*this) + pixels_.capacity() * sizeof(Uint32);
+}
+
+size_t LevelTile::GetTextureBytes() const {
+	return texture_ ? Tile::tile_size_ * Tile::tile_size_ * 4 : 0;
+}
+
+bool LevelTile::NeedsUpgrade() const {
+	return !texture_;
+}
+
+void LevelTile::Upgrade(TexturePool& pool) {
+	if (texture_)
+		return;
+
+	texture_.reset(new SDL2pp::Texture(pool.Acquire()));
+	pool_ = &pool;
+
+	texture_->Update(SDL2pp::NullOpt, pixels_.data(), Tile::tile_size_ * 4);
+
+	Pixels().swap(pixels_);
+}
+
+void LevelTile::Render(SDL2pp::Renderer& renderer, const SDL2pp::Rect& viewport) {
+	if (texture_ && GetRect().Intersects(viewport))
+		renderer.Copy(*texture_, SDL2pp::NullOpt, GetRect() - viewport.GetTopLeft());
+}
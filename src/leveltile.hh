@@ -0,0 +1,82 @@
+/*
+ * Copyright (C) 2015 Dmitry Marakasov <amdmi3@amdmi3.ru>
+ *
+ * This file is part of hoverboard-sdl.
+ *
+ * hoverboard-sdl is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * hoverboard-sdl is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with hoverboard-sdl.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LEVELTILE_HH
+#define LEVELTILE_HH
+
+#include <memory>
+#include <vector>
+
+#include <SDL2pp/Point.hh>
+#include <SDL2pp/Rect.hh>
+#include <SDL2pp/Renderer.hh>
+#include <SDL2pp/Texture.hh>
+
+class TexturePool;
+
+// Downsampled image of a square block of 2^level x 2^level tiles,
+// used to render zoomed out views. Level tiles have the same size
+// as regular ones, so number of tiles (and thus draw calls and
+// texture memory) needed to cover the screen stays the same at
+// any level, provided the level matches camera scale
+class LevelTile {
+public:
+	static constexpr int max_level_ = 3;
+
+	typedef std::vector<Uint32> Pixels; // ARGB8888, tile_size_ x tile_size_
+
+private:
+	int level_;
+	SDL2pp::Point coords_;
+
+	// downsampled image, until it's uploaded
+	Pixels pixels_;
+
+	TexturePool* pool_ = nullptr;
+	std::unique_ptr<SDL2pp::Texture> texture_;
+
+public:
+	LevelTile(int level, const SDL2pp::Point& coords, Pixels&& pixels);
+	~LevelTile();
+
+	// no move assignment, as replaced texture would have to be
+	// returned to the pool, and nothing needs it
+	LevelTile(LevelTile&&) noexcept = default;
+	LevelTile(const LevelTile&) = delete;
+	LevelTile& operator=(LevelTile&&) = delete;
+	LevelTile& operator=(const LevelTile&) = delete;
+
+	// level to use for given camera scale (screen pixels per world
+	// pixel), 0 meaning regular tiles
+	static int LevelForScale(float scale);
+
+	static SDL2pp::Point CoordsForPoint(int level, const SDL2pp::Point& p);
+	static SDL2pp::Rect RectForCoords(int level, const SDL2pp::Point& coords);
+
+	SDL2pp::Rect GetRect() const;
+
+	size_t GetCpuBytes() const;
+	size_t GetTextureBytes() const;
+
+	bool NeedsUpgrade() const;
+	void Upgrade(TexturePool& pool);
+	void Render(SDL2pp::Renderer& renderer, const SDL2pp::Rect& viewport);
+};
+
+#endif // LEVELTILE_HH
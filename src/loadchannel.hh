@@ -0,0 +1,251 @@
+/*
+ * Copyright (C) 2015 Dmitry Marakasov <amdmi3@amdmi3.ru>
+ *
+ * This file is part of hoverboard-sdl.
+ *
+ * hoverboard-sdl is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * hoverboard-sdl is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with hoverboard-sdl.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LOADCHANNEL_HH
+#define LOADCHANNEL_HH
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <vector>
+
+// Hands work between the main thread and loader threads without
+// locking on the common path
+//
+// Requests go one way: the main thread publishes versioned sets of
+// keys to load, in priority order, and loaders take keys from the
+// latest set with a single atomic increment. Results go the other
+// way, through a lock-free list (multiple producers, single
+// consumer) of loaded values moved out of loaders.
+//
+// The main thread tracks which keys are in flight, so these are not
+// requested again, and it may wait for them in the synchronous phase,
+// which is the only place where it blocks on loaders. Each request
+// set also lists in-flight keys which are still wanted; the rest
+// are stale, and loaders may abandon them.
+template<class K, class T>
+class LoadChannel {
+public:
+	struct Stats {
+		size_t loaded = 0;
+		size_t cancelled = 0;
+		float cancelled_ms = 0.0f;
+	};
+
+private:
+	struct Requests {
+		uint64_t version = 0;
+		std::vector<K> queue;
+		std::set<K> wanted;          // in-flight keys which are still wanted
+		std::atomic<size_t> next{0}; // next key in queue to be taken
+	};
+
+	struct Result {
+		K key;
+		std::unique_ptr<T> value;  // empty if load was abandoned
+		float elapsed_ms;
+		Result* next;
+	};
+
+	// set in place of next queue index, so no more keys are taken
+	static constexpr size_t closed_ = SIZE_MAX / 2;
+
+public:
+	// held by loader for the duration of a load
+	class Ticket {
+		friend class LoadChannel;
+
+	private:
+		std::shared_ptr<Requests> requests_;
+		K key_;
+
+	public:
+		const K& GetKey() const {
+			return key_;
+		}
+	};
+
+private:
+	// shared; requests_ is only accessed with std::atomic_load/store
+	std::shared_ptr<Requests> requests_;
+	std::atomic<uint64_t> version_{0};
+	std::atomic<Result*> results_{nullptr};
+
+	// only used for sleeping while waiting for results
+	std::mutex results_mutex_;
+	std::condition_variable results_condvar_;
+
+	// main thread only
+	std::set<K> in_flight_;
+	bool closed_requests_ = true;
+	Stats stats_;
+
+private:
+	void Close() {
+		if (closed_requests_)
+			return;
+		closed_requests_ = true;
+
+		// keys taken before closing are in flight now
+		std::shared_ptr<Requests> requests = std::atomic_load(&requests_);
+		size_t taken = std::min(requests->next.exchange(closed_), requests->queue.size());
+		in_flight_.insert(requests->queue.begin(), requests->queue.begin() + taken);
+	}
+
+public:
+	LoadChannel() {
+	}
+
+	~LoadChannel() {
+		// loaders are expected to be finished by now
+		for (Result* result = results_.load(); result != nullptr; ) {
+			Result* next = result->next;
+			delete result;
+			result = next;
+		}
+	}
+
+	LoadChannel(const LoadChannel&) = delete;
+	LoadChannel& operator=(const LoadChannel&) = delete;
+
+	//
+	// Loader side
+	//
+
+	bool HasWork() const {
+		std::shared_ptr<Requests> requests = std::atomic_load(&requests_);
+		return requests && requests->next.load() < requests->queue.size();
+	}
+
+	// returns false if there's nothing to load
+	bool Take(Ticket& ticket) {
+		std::shared_ptr<Requests> requests = std::atomic_load(&requests_);
+		if (!requests)
+			return false;
+
+		size_t index = requests->next.fetch_add(1);
+		if (index >= requests->queue.size())
+			return false;
+
+		ticket.key_ = requests->queue[index];
+		ticket.requests_ = std::move(requests);
+		return true;
+	}
+
+	bool IsStale(const Ticket& ticket) const {
+		if (ticket.requests_->version == version_.load())
+			return false;
+
+		std::shared_ptr<Requests> requests = std::atomic_load(&requests_);
+		return requests->wanted.find(ticket.key_) == requests->wanted.end();
+	}
+
+	// value is empty if the load was abandoned
+	void Complete(Ticket&& ticket, std::unique_ptr<T> value, float elapsed_ms) {
+		Result* result = new Result{ ticket.key_, std::move(value), elapsed_ms, results_.load(std::memory_order_relaxed) };
+		while (!results_.compare_exchange_weak(result->next, result, std::memory_order_release, std::memory_order_relaxed)) {
+		}
+
+		ticket.requests_.reset();
+
+		// empty critical section makes sure the main thread is
+		// either not yet checking for results, or already waits
+		// for the notification
+		{
+			std::lock_guard<std::mutex> lock(results_mutex_);
+		}
+		results_condvar_.notify_all();
+	}
+
+	//
+	// Main thread side
+	//
+
+	// replaces current requests; in-flight keys for which wanted()
+	// returns false become stale
+	template<class F>
+	void Publish(std::vector<K>&& queue, F wanted) {
+		Close();
+
+		std::shared_ptr<Requests> requests = std::make_shared<Requests>();
+		requests->version = version_.load() + 1;
+		requests->queue = std::move(queue);
+		for (auto& key : in_flight_)
+			if (wanted(key))
+				requests->wanted.insert(key);
+
+		std::atomic_store(&requests_, requests);
+		version_ = requests->version;
+		closed_requests_ = false;
+	}
+
+	// passes finished loads to consumer(const K&, T&&)
+	template<class F>
+	void Flush(F consumer) {
+		Close();
+
+		for (Result* result = results_.exchange(nullptr, std::memory_order_acquire); result != nullptr; ) {
+			std::unique_ptr<Result> holder(result);
+			result = result->next;
+
+			in_flight_.erase(holder->key);
+
+			if (holder->value) {
+				stats_.loaded++;
+				consumer(holder->key, std::move(*holder->value));
+			} else {
+				stats_.cancelled++;
+				stats_.cancelled_ms += holder->elapsed_ms;
+			}
+		}
+	}
+
+	// flushes results until no key for which pred() returns true
+	// is in flight
+	template<class P, class F>
+	void WaitFor(P pred, F consumer) {
+		Flush(consumer);
+
+		while (std::any_of(in_flight_.begin(), in_flight_.end(), pred)) {
+			{
+				std::unique_lock<std::mutex> lock(results_mutex_);
+				results_condvar_.wait(lock, [this]() { return results_.load() != nullptr; });
+			}
+
+			Flush(consumer);
+		}
+	}
+
+	bool IsInFlight(const K& key) const {
+		return in_flight_.find(key) != in_flight_.end();
+	}
+
+	const Stats& GetStats() const {
+		return stats_;
+	}
+};
+
+template<class K, class T>
+constexpr size_t LoadChannel<K, T>::closed_;
+
+#endif // LOADCHANNEL_HH
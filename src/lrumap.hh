@@ -0,0 +1,195 @@
+/*
+ * Copyright (C) 2015 Dmitry Marakasov <amdmi3@amdmi3.ru>
+ *
+ * This file is part of hoverboard-sdl.
+ *
+ * hoverboard-sdl is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * hoverboard-sdl is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with hoverboard-sdl.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LRUMAP_HH
+#define LRUMAP_HH
+
+#include <cstdint>
+#include <tuple>
+#include <unordered_map>
+#include <utility>
+
+#include <SDL2pp/Point.hh>
+
+// Associative container keyed on tile coordinates with embedded
+// doubly linked list which keeps items in recently used order.
+// Lookup, insertion, touch and eviction of the least recently
+// used item are all O(1) and do not allocate besides a single
+// hash node per inserted item.
+template<class T>
+class LruMap {
+public:
+	enum class Visit {
+		KEEP,   // leave item and continue
+		EVICT,  // remove item and continue
+		STOP,   // stop walking
+	};
+
+private:
+	struct Node {
+		T value;
+		uint64_t key;
+		Node* prev = nullptr;  // more recently used
+		Node* next = nullptr;  // less recently used
+
+		Node(uint64_t k, T&& v) : value(std::move(v)), key(k) {
+		}
+	};
+
+	struct KeyHash {
+		size_t operator()(uint64_t key) const {
+			// keys are densely packed coordinates, mix them a bit
+			key ^= key >> 29;
+			key *= 0xbf58476d1ce4e5b9ULL;
+			key ^= key >> 32;
+			return key;
+		}
+	};
+
+	typedef std::unordered_map<uint64_t, Node, KeyHash> NodeMap;
+
+private:
+	NodeMap nodes_;
+	Node* head_ = nullptr;  // most recently used
+	Node* tail_ = nullptr;  // least recently used
+
+private:
+	static uint64_t PackKey(const SDL2pp::Point& coords) {
+		return (uint64_t)(uint32_t)coords.x << 32 | (uint32_t)coords.y;
+	}
+
+	static SDL2pp::Point UnpackKey(uint64_t key) {
+		return SDL2pp::Point((int32_t)(uint32_t)(key >> 32), (int32_t)(uint32_t)key);
+	}
+
+	void Unlink(Node* node) {
+		(node->prev ? node->prev->next : head_) = node->next;
+		(node->next ? node->next->prev : tail_) = node->prev;
+		node->prev = node->next = nullptr;
+	}
+
+	void LinkFront(Node* node) {
+		node->next = head_;
+		(head_ ? head_->prev : tail_) = node;
+		head_ = node;
+	}
+
+	void Erase(Node* node) {
+		// key is looked up first, as erasing by key stored
+		// in the node being destroyed is not safe
+		auto iter = nodes_.find(node->key);
+		Unlink(node);
+		nodes_.erase(iter);
+	}
+
+public:
+	LruMap() {
+	}
+
+	LruMap(const LruMap&) = delete;
+	LruMap& operator=(const LruMap&) = delete;
+
+	// doesn't affect recency
+	T* Find(const SDL2pp::Point& coords) {
+		auto iter = nodes_.find(PackKey(coords));
+		return iter == nodes_.end() ? nullptr : &iter->second.value;
+	}
+
+	// marks item as most recently used
+	T* Touch(const SDL2pp::Point& coords) {
+		auto iter = nodes_.find(PackKey(coords));
+		if (iter == nodes_.end())
+			return nullptr;
+
+		Node* node = &iter->second;
+		if (node != head_) {
+			Unlink(node);
+			LinkFront(node);
+		}
+		return &node->value;
+	}
+
+	// inserts item as most recently used; if item already
+	// exists, it's just touched and value is discarded
+	T& Insert(const SDL2pp::Point& coords, T&& value) {
+		uint64_t key = PackKey(coords);
+		auto result = nodes_.emplace(std::piecewise_construct, std::forward_as_tuple(key), std::forward_as_tuple(key, std::move(value)));
+
+		Node* node = &result.first->second;
+		if (!result.second)
+			Unlink(node);
+		LinkFront(node);
+
+		return node->value;
+	}
+
+	void Erase(const SDL2pp::Point& coords) {
+		auto iter = nodes_.find(PackKey(coords));
+		if (iter != nodes_.end()) {
+			Unlink(&iter->second);
+			nodes_.erase(iter);
+		}
+	}
+
+	size_t Size() const {
+		return nodes_.size();
+	}
+
+	bool Empty() const {
+		return nodes_.empty();
+	}
+
+	T* GetOldest() {
+		return tail_ ? &tail_->value : nullptr;
+	}
+
+	SDL2pp::Point GetOldestCoords() const {
+		return UnpackKey(tail_->key);
+	}
+
+	void PopOldest() {
+		Erase(tail_);
+	}
+
+	// walks items from least to most recently used, except for
+	// skip_recent most recently used ones; visitor is called as
+	// Visit visitor(T& value) and decides what to do with items
+	template<class F>
+	void WalkOldest(size_t skip_recent, F visitor) {
+		size_t remaining = nodes_.size() > skip_recent ? nodes_.size() - skip_recent : 0;
+
+		for (Node* node = tail_; node && remaining > 0; remaining--) {
+			Node* prev = node->prev;
+
+			switch (visitor(node->value)) {
+			case Visit::STOP:
+				return;
+			case Visit::EVICT:
+				Erase(node);
+				break;
+			case Visit::KEEP:
+				break;
+			}
+
+			node = prev;
+		}
+	}
+};
+
+#endif // LRUMAP_HH
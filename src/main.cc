@@ -105,6 +105,15 @@ int main(int, char*[]) try {
 				case SDLK_TAB:
 					game.ToggleMinimap();
 					break;
+				case SDLK_F3:
+					game.ToggleCacheStats();
+					break;
+				case SDLK_MINUS: case SDLK_KP_MINUS:
+					game.ZoomOut();
+					break;
+				case SDLK_EQUALS: case SDLK_PLUS: case SDLK_KP_PLUS:
+					game.ZoomIn();
+					break;
 				}
 
 				auto teleport_slot = teleport_slots.find(event.key.keysym.sym);
@@ -129,6 +138,8 @@ int main(int, char*[]) try {
 					game.ClearActionFlag(Game::DOWN);
 					break;
 				}
+			} else if (event.type == SDL_RENDER_TARGETS_RESET || event.type == SDL_RENDER_DEVICE_RESET) {
+				game.InvalidateRenderCache();
 			}
 		}
 
@@ -0,0 +1,264 @@
+/*
+ * Copyright (C) 2015 Dmitry Marakasov <amdmi3@amdmi3.ru>
+ *
+ * This file is part of hoverboard-sdl.
+ *
+ * hoverboard-sdl is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * hoverboard-sdl is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with hoverboard-sdl.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "minimap.hh"
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <stdexcept>
+
+#include <SDL_thread.h>
+
+#include "tile.hh"
+#include "tilearchive.hh"
+#include "tilemanifest.hh"
+
+constexpr char MinimapBuilder::magic_[8];
+constexpr uint32_t MinimapBuilder::version_;
+constexpr size_t MinimapBuilder::header_size_;
+constexpr Uint32 MinimapBuilder::color_;
+constexpr unsigned int MinimapBuilder::max_threads_;
+
+namespace {
+
+uint32_t ReadUint32(const unsigned char* data) {
+	return (uint32_t)data[0] | (uint32_t)data[1] << 8 | (uint32_t)data[2] << 16 | (uint32_t)data[3] << 24;
+}
+
+int32_t ReadInt32(const unsigned char* data) {
+	return (int32_t)ReadUint32(data);
+}
+
+void WriteUint32(std::ostream& stream, uint32_t value) {
+	const char bytes[4] = { (char)(value & 0xff), (char)((value >> 8) & 0xff), (char)((value >> 16) & 0xff), (char)((value >> 24) & 0xff) };
+	stream.write(bytes, sizeof(bytes));
+}
+
+void WriteInt32(std::ostream& stream, int32_t value) {
+	WriteUint32(stream, (uint32_t)value);
+}
+
+int64_t GetModificationTime(const std::string& path) {
+	struct stat st;
+	if (stat(path.c_str(), &st) != 0)
+		return 0;
+	return (int64_t)st.st_mtime;
+}
+
+}
+
+MinimapBuilder::MinimapBuilder(const SDL2pp::Rect& tiles_rect, int tile_pixels, const std::string& cache_path)
+	: tiles_rect_(tiles_rect),
+	  tile_pixels_(tile_pixels),
+	  level_(LevelForTilePixels(tile_pixels)),
+	  cache_path_(cache_path),
+	  pixels_((size_t)tiles_rect.w * tile_pixels * tiles_rect.h * tile_pixels, 0) {
+	thread_ = std::thread(&MinimapBuilder::Run, this);
+}
+
+MinimapBuilder::~MinimapBuilder() {
+	cancelled_ = true;
+	thread_.join();
+}
+
+int MinimapBuilder::LevelForTilePixels(int tile_pixels) {
+	int level = 0;
+	while (tile_pixels > 0 && (Tile::tile_size_ >> level) > tile_pixels)
+		level++;
+
+	if (tile_pixels <= 0 || (tile_pixels << level) != Tile::tile_size_)
+		throw std::logic_error("minimap tile size must be tile size divided by power of two");
+
+	return level;
+}
+
+Uint32 MinimapBuilder::MaskPixel(Uint32 color) {
+	// the tile is composed over white, then its luma is inverted
+	// and used as alpha, so lines are opaque and blank space is
+	// transparent
+	const Uint32 a = color >> 24;
+	const Uint32 r = (color >> 16) & 0xff;
+	const Uint32 g = (color >> 8) & 0xff;
+	const Uint32 b = color & 0xff;
+
+	const Uint32 luma = (r * 299 + g * 587 + b * 114) / 1000;
+	const Uint32 composed = (luma * a + 255 * (255 - a)) / 255;
+
+	return (255 - composed) << 24 | color_;
+}
+
+int64_t MinimapBuilder::GetDataStamp() const {
+	// adding, removing or replacing a tile file changes mtime of
+	// its column directory, so we don't need to stat every tile
+	int64_t stamp = std::max({
+			GetModificationTime(HOVERBOARD_DATADIR),
+			GetModificationTime(HOVERBOARD_TILEPACK),
+			GetModificationTime(HOVERBOARD_TILEMANIFEST),
+		});
+
+	for (int x = tiles_rect_.x; x <= tiles_rect_.GetX2(); x++)
+		stamp = std::max(stamp, GetModificationTime(std::string(HOVERBOARD_DATADIR) + "/" + std::to_string(x)));
+
+	return stamp;
+}
+
+bool MinimapBuilder::LoadCache(int64_t stamp) {
+	std::ifstream file(cache_path_, std::ios::in | std::ios::binary);
+	if (!file.good())
+		return false;
+
+	std::vector<unsigned char> data{std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>()};
+
+	// any mismatch just means that the cache is stale
+	if (data.size() != header_size_ + pixels_.size() ||
+			std::memcmp(data.data(), magic_, sizeof(magic_)) != 0 ||
+			ReadUint32(data.data() + 8) != version_ ||
+			ReadUint32(data.data() + 12) != (uint32_t)((uint64_t)stamp & 0xffffffff) ||
+			ReadUint32(data.data() + 16) != (uint32_t)((uint64_t)stamp >> 32) ||
+			ReadInt32(data.data() + 20) != tiles_rect_.x ||
+			ReadInt32(data.data() + 24) != tiles_rect_.y ||
+			ReadUint32(data.data() + 28) != (uint32_t)tiles_rect_.w ||
+			ReadUint32(data.data() + 32) != (uint32_t)tiles_rect_.h ||
+			ReadUint32(data.data() + 36) != (uint32_t)tile_pixels_)
+		return false;
+
+	std::transform(data.begin() + header_size_, data.end(), pixels_.begin(), [](unsigned char alpha) {
+			return (Uint32)alpha << 24 | color_;
+		});
+
+	return true;
+}
+
+void MinimapBuilder::SaveCache(int64_t stamp) const {
+	std::ofstream file(cache_path_, std::ios::out | std::ios::trunc | std::ios::binary);
+	if (!file.good())
+		throw std::runtime_error("cannot open " + cache_path_ + " for writing");
+
+	// header
+	file.write(magic_, sizeof(magic_));
+	WriteUint32(file, version_);
+	WriteUint32(file, (uint32_t)((uint64_t)stamp & 0xffffffff));
+	WriteUint32(file, (uint32_t)((uint64_t)stamp >> 32));
+	WriteInt32(file, tiles_rect_.x);
+	WriteInt32(file, tiles_rect_.y);
+	WriteUint32(file, (uint32_t)tiles_rect_.w);
+	WriteUint32(file, (uint32_t)tiles_rect_.h);
+	WriteUint32(file, (uint32_t)tile_pixels_);
+
+	// alpha
+	std::vector<char> alpha(pixels_.size());
+	std::transform(pixels_.begin(), pixels_.end(), alpha.begin(), [](Uint32 pixel) {
+			return (char)(pixel >> 24);
+		});
+	file.write(alpha.data(), alpha.size());
+
+	if (!file.good())
+		throw std::runtime_error("cannot write " + cache_path_);
+}
+
+void MinimapBuilder::Build() {
+	TileArchive archive(HOVERBOARD_TILEPACK);
+	TileManifest manifest(HOVERBOARD_TILEMANIFEST);
+
+	const int pitch = GetWidth();
+	const int ntiles = tiles_rect_.w * tiles_rect_.h;
+
+	// tiles are handed out one by one, each worker writes its
+	// own square of the image
+	std::atomic<int> next_tile{0};
+
+	auto worker = [&]() {
+		// leave cores to tile loaders and main thread first
+		SDL_SetThreadPriority(SDL_THREAD_PRIORITY_LOW);
+
+		int ntile;
+		while (!cancelled_ && (ntile = next_tile++) < ntiles) {
+			SDL2pp::Point offset(ntile % tiles_rect_.w, ntile / tiles_rect_.w);
+			SDL2pp::Point coords = tiles_rect_.GetTopLeft() + offset;
+			Uint32* output = pixels_.data() + (size_t)offset.y * tile_pixels_ * pitch + (size_t)offset.x * tile_pixels_;
+
+			try {
+				const unsigned char* record = manifest.Find(coords);
+				if (record && Tile::IsTrivialRaw(record, Tile::Layers::VISUALS))
+					Tile(coords, record, TileManifest::record_size_, Tile::Layers::VISUALS).Downsample(level_, output, pitch);
+				else
+					Tile(coords, archive, Tile::Layers::VISUALS).Downsample(level_, output, pitch);
+			} catch (std::exception& e) {
+				std::cerr << "Warning: cannot load tile " << coords.x << "," << coords.y << " for minimap: " << e.what() << std::endl;
+				continue;
+			}
+
+			for (int y = 0; y < tile_pixels_; y++, output += pitch)
+				std::transform(output, output + tile_pixels_, output, MaskPixel);
+		}
+	};
+
+	// hardware_concurrency() may return 0 if it cannot determine
+	// number of cores
+	unsigned int ncores = std::thread::hardware_concurrency();
+	unsigned int nthreads = std::min(ncores > 1 ? ncores - 1 : 1, max_threads_);
+
+	std::vector<std::thread> threads(nthreads);
+	for (auto& thread : threads)
+		thread = std::thread(worker);
+	for (auto& thread : threads)
+		thread.join();
+}
+
+void MinimapBuilder::Run() {
+	try {
+		const int64_t stamp = GetDataStamp();
+
+		if (cache_path_.empty() || !LoadCache(stamp)) {
+			Build();
+
+			if (cancelled_)
+				return;
+
+			if (!cache_path_.empty())
+				SaveCache(stamp);
+		}
+	} catch (std::exception& e) {
+		std::cerr << "Warning: minimap: " << e.what() << std::endl;
+	}
+
+	ready_ = true;
+}
+
+bool MinimapBuilder::IsReady() const {
+	return ready_;
+}
+
+int MinimapBuilder::GetWidth() const {
+	return tiles_rect_.w * tile_pixels_;
+}
+
+int MinimapBuilder::GetHeight() const {
+	return tiles_rect_.h * tile_pixels_;
+}
+
+const MinimapBuilder::Pixels& MinimapBuilder::GetPixels() const {
+	return pixels_;
+}
@@ -0,0 +1,107 @@
+/*
+ * Copyright (C) 2015 Dmitry Marakasov <amdmi3@amdmi3.ru>
+ *
+ * This file is part of hoverboard-sdl.
+ *
+ * hoverboard-sdl is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * hoverboard-sdl is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with hoverboard-sdl.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef MINIMAP_HH
+#define MINIMAP_HH
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <SDL_stdinc.h>
+
+#include <SDL2pp/Rect.hh>
+
+// Builds minimap image from world tiles in background: each tile
+// is box filtered into a square of tile_pixels pixels, which is
+// then turned into gray alpha mask, darker areas being more opaque
+//
+// The result is cached in a file, stamped with latest modification
+// time of tile data (data directory and its tile columns, tile
+// archive and manifest), and is only rebuilt when the data changes.
+// All integers are little-endian. Cache file layout:
+//
+//   header:  char[8] magic ("HBMINIM\0")
+//            uint32  version
+//            uint32  low, high halves of data stamp
+//            int32   x, y of the top left tile
+//            uint32  width, height in tiles
+//            uint32  pixels per tile
+//   alpha:   one byte per minimap pixel, row by row
+class MinimapBuilder {
+public:
+	typedef std::vector<Uint32> Pixels;  // ARGB8888
+
+	static constexpr char magic_[8] = { 'H', 'B', 'M', 'I', 'N', 'I', 'M', '\0' };
+	static constexpr uint32_t version_ = 1;
+	static constexpr size_t header_size_ = 40;
+
+	// color of mask
+	static constexpr Uint32 color_ = 0x7e7e7e;
+
+	// limit on low priority build workers; there are also no more
+	// of these than cores, one core being left for the main thread
+	static constexpr unsigned int max_threads_ = 4;
+
+private:
+	const SDL2pp::Rect tiles_rect_;
+	const int tile_pixels_;
+	const int level_;
+	const std::string cache_path_;
+
+	Pixels pixels_;
+
+	std::atomic<bool> ready_{false};
+	std::atomic<bool> cancelled_{false};
+
+	std::thread thread_;
+
+private:
+	static int LevelForTilePixels(int tile_pixels);
+	static Uint32 MaskPixel(Uint32 color);
+
+	int64_t GetDataStamp() const;
+
+	bool LoadCache(int64_t stamp);
+	void SaveCache(int64_t stamp) const;
+
+	void Build();
+	void Run();
+
+public:
+	// Starts building at once; cache_path may be empty to disable
+	// caching
+	MinimapBuilder(const SDL2pp::Rect& tiles_rect, int tile_pixels, const std::string& cache_path);
+	~MinimapBuilder();
+
+	MinimapBuilder(const MinimapBuilder&) = delete;
+	MinimapBuilder& operator=(const MinimapBuilder&) = delete;
+
+	bool IsReady() const;
+
+	int GetWidth() const;
+	int GetHeight() const;
+
+	// only valid when ready
+	const Pixels& GetPixels() const;
+};
+
+#endif // MINIMAP_HH
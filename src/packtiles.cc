@@ -0,0 +1,124 @@
+/*
+ * Copyright (C) 2015 Dmitry Marakasov <amdmi3@amdmi3.ru>
+ *
+ * This file is part of hoverboard-sdl.
+ *
+ * hoverboard-sdl is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * hoverboard-sdl is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with hoverboard-sdl.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Packs tiles from data directory (<datadir>/<x>/<y>.png) into
+// a single tile archive, see tilearchive.hh for format
+//
+// With --raw, tiles are converted into pre-decoded format which
+// is much larger, but does not need PNG decoding at runtime
+//
+// With --manifest, tile manifest is written as well, see
+// tilemanifest.hh
+
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <string>
+
+#include <SDL2pp/Surface.hh>
+
+#include "tile.hh"
+#include "tilearchive.hh"
+#include "tilemanifest.hh"
+
+namespace fs = std::filesystem;
+
+static bool ParseInt(const std::string& str, int& value) {
+	size_t pos;
+	try {
+		value = std::stoi(str, &pos);
+	} catch (std::logic_error&) {
+		return false;
+	}
+	return pos == str.size();
+}
+
+int main(int argc, char** argv) try {
+	bool raw = false;
+	std::string manifest;
+
+	int arg = 1;
+	for (; arg < argc && argv[arg][0] == '-'; arg++) {
+		if (std::string(argv[arg]) == "--raw")
+			raw = true;
+		else if (std::string(argv[arg]) == "--manifest" && arg + 1 < argc)
+			manifest = argv[++arg];
+		else
+			break;
+	}
+
+	if (argc - arg != 2) {
+		std::cerr << "Usage: " << argv[0] << " [--raw] [--manifest <output manifest>] <data directory> <output archive>" << std::endl;
+		return 1;
+	}
+
+	const char* datadir = argv[arg];
+	const char* output = argv[arg + 1];
+
+	TileArchiveWriter writer(raw ? TileArchive::Format::RAW : TileArchive::Format::PNG);
+	TileManifestWriter manifest_writer;
+	size_t ntiles = 0;
+
+	for (auto& xdir : fs::directory_iterator(datadir)) {
+		int x;
+		if (!xdir.is_directory() || !ParseInt(xdir.path().filename().string(), x))
+			continue;
+
+		for (auto& file : fs::directory_iterator(xdir.path())) {
+			int y;
+			if (!file.is_regular_file() || file.path().extension() != ".png" || !ParseInt(file.path().stem().string(), y))
+				continue;
+
+			std::vector<unsigned char> encoded;
+			if (raw || !manifest.empty()) {
+				SDL2pp::Surface surface(file.path().string());
+				encoded = Tile::EncodeRaw(surface);
+				manifest_writer.AddTile(SDL2pp::Point(x, y), encoded.data());
+			}
+
+			if (raw) {
+				writer.AddTile(SDL2pp::Point(x, y), std::move(encoded));
+			} else {
+				std::ifstream stream(file.path(), std::ios::in | std::ios::binary);
+				std::vector<unsigned char> data{std::istreambuf_iterator<char>(stream), std::istreambuf_iterator<char>()};
+				if (!stream.good() && !stream.eof())
+					throw std::runtime_error("cannot read " + file.path().string());
+
+				writer.AddTile(SDL2pp::Point(x, y), std::move(data));
+			}
+			ntiles++;
+		}
+	}
+
+	writer.Write(output);
+
+	std::cerr << "Packed " << ntiles << " tiles into " << output << std::endl;
+
+	if (!manifest.empty()) {
+		manifest_writer.Write(manifest);
+
+		std::cerr << "Wrote tile manifest " << manifest << std::endl;
+	}
+
+	return 0;
+} catch (std::exception& e) {
+	std::cerr << "Error: " << e.what() << std::endl;
+	return 1;
+}
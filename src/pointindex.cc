@@ -0,0 +1,58 @@
+/*
+ * Copyright (C) 2015 Dmitry Marakasov <amdmi3@amdmi3.ru>
+ *
+ * This file is part of hoverboard-sdl.
+ *
+ * hoverboard-sdl is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * hoverboard-sdl is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with hoverboard-sdl.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "pointindex.hh"
+
+#include <algorithm>
+#include <numeric>
+
+PointIndex::PointIndex(const std::vector<SDL2pp::Point>& points) {
+	if (points.empty()) {
+		cell_starts_.assign(1, 0);
+		return;
+	}
+
+	SDL2pp::Point min_tile = Tile::CoordsForPoint(points.front());
+	SDL2pp::Point max_tile = min_tile;
+	for (auto& point : points) {
+		SDL2pp::Point tilecoord = Tile::CoordsForPoint(point);
+		min_tile.x = std::min(min_tile.x, tilecoord.x);
+		min_tile.y = std::min(min_tile.y, tilecoord.y);
+		max_tile.x = std::max(max_tile.x, tilecoord.x);
+		max_tile.y = std::max(max_tile.y, tilecoord.y);
+	}
+
+	tiles_rect_ = SDL2pp::Rect::FromCorners(min_tile, max_tile);
+
+	// count points per cell, and turn counts into offsets
+	cell_starts_.assign(tiles_rect_.w * tiles_rect_.h + 1, 0);
+	for (auto& point : points)
+		cell_starts_[GetCellIndex(Tile::CoordsForPoint(point)) + 1]++;
+	std::partial_sum(cell_starts_.begin(), cell_starts_.end(), cell_starts_.begin());
+
+	// place point numbers, keeping original order within a cell
+	std::vector<size_t> cell_ends(cell_starts_.begin(), cell_starts_.end() - 1);
+	points_.resize(points.size());
+	for (size_t npoint = 0; npoint < points.size(); npoint++)
+		points_[cell_ends[GetCellIndex(Tile::CoordsForPoint(points[npoint]))]++] = npoint;
+}
+
+size_t PointIndex::GetCellIndex(const SDL2pp::Point& tilecoord) const {
+	return (size_t)(tilecoord.x - tiles_rect_.x) + (size_t)(tilecoord.y - tiles_rect_.y) * tiles_rect_.w;
+}
@@ -0,0 +1,72 @@
+/*
+ * Copyright (C) 2015 Dmitry Marakasov <amdmi3@amdmi3.ru>
+ *
+ * This file is part of hoverboard-sdl.
+ *
+ * hoverboard-sdl is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * hoverboard-sdl is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with hoverboard-sdl.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef POINTINDEX_HH
+#define POINTINDEX_HH
+
+#include <vector>
+
+#include <SDL2pp/Point.hh>
+#include <SDL2pp/Rect.hh>
+
+#include "tile.hh"
+
+// Static index of points by tile they fall into
+//
+// Points are bucketed with counting sort into a compact grid over
+// their bounding box in tile coordinates: for each grid cell we
+// store an offset into a single array of point numbers, so
+// lookups only touch points in tiles overlapping given area.
+class PointIndex {
+private:
+	SDL2pp::Rect tiles_rect_;
+	std::vector<size_t> cell_starts_;  // one per cell, plus end marker
+	std::vector<size_t> points_;       // numbers of points, grouped by cell
+
+private:
+	size_t GetCellIndex(const SDL2pp::Point& tilecoord) const;
+
+public:
+	PointIndex(const std::vector<SDL2pp::Point>& points);
+
+	// processor is called with number of each point (that is,
+	// its index in vector given to constructor) in tiles which
+	// overlap rect; these may still lie outside of rect itself
+	template<class T>
+	void ProcessPointsInRect(const SDL2pp::Rect& rect, T processor) const {
+		auto area = SDL2pp::Rect::FromCorners(
+				Tile::CoordsForPoint(SDL2pp::Point(rect.x, rect.y)),
+				Tile::CoordsForPoint(SDL2pp::Point(rect.GetX2(), rect.GetY2()))
+			).GetIntersection(tiles_rect_);
+
+		if (!area)
+			return;
+
+		SDL2pp::Point tilecoord;
+		for (tilecoord.y = area->y; tilecoord.y <= area->GetY2(); tilecoord.y++) {
+			for (tilecoord.x = area->x; tilecoord.x <= area->GetX2(); tilecoord.x++) {
+				size_t cell = GetCellIndex(tilecoord);
+				for (size_t i = cell_starts_[cell]; i < cell_starts_[cell + 1]; i++)
+					processor(points_[i]);
+			}
+		}
+	}
+};
+
+#endif // POINTINDEX_HH
@@ -0,0 +1,79 @@
+/*
+ * Copyright (C) 2015 Dmitry Marakasov <amdmi3@amdmi3.ru>
+ *
+ * This file is part of hoverboard-sdl.
+ *
+ * hoverboard-sdl is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * hoverboard-sdl is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with hoverboard-sdl.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "rle.hh"
+
+static constexpr size_t max_chunk_ = 128;
+static constexpr size_t min_run_ = 3;
+
+static size_t RunLength(const unsigned char* data, size_t size, size_t pos) {
+	size_t length = 1;
+	while (pos + length < size && length < max_chunk_ && data[pos + length] == data[pos])
+		length++;
+	return length;
+}
+
+std::vector<unsigned char> RleCompress(const unsigned char* data, size_t size) {
+	std::vector<unsigned char> result;
+
+	size_t pos = 0;
+	while (pos < size) {
+		size_t run = RunLength(data, size, pos);
+		if (run >= min_run_) {
+			result.push_back(257 - run);
+			result.push_back(data[pos]);
+			pos += run;
+			continue;
+		}
+
+		// gather literals until next worthy run
+		size_t start = pos;
+		while (pos < size && pos - start < max_chunk_ && RunLength(data, size, pos) < min_run_)
+			pos++;
+
+		result.push_back(pos - start - 1);
+		result.insert(result.end(), data + start, data + pos);
+	}
+
+	result.shrink_to_fit();
+	return result;
+}
+
+bool RleDecompress(const unsigned char* data, size_t size, std::vector<unsigned char>& output) {
+	size_t pos = 0;
+	while (pos < size) {
+		unsigned char control = data[pos++];
+
+		if (control < 128) {
+			size_t count = control + 1;
+			if (size - pos < count)
+				return false;
+
+			output.insert(output.end(), data + pos, data + pos + count);
+			pos += count;
+		} else if (control > 128) {
+			if (pos == size)
+				return false;
+
+			output.insert(output.end(), 257 - control, data[pos++]);
+		}
+	}
+
+	return true;
+}
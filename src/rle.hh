@@ -0,0 +1,40 @@
+/*
+ * Copyright (C) 2015 Dmitry Marakasov <amdmi3@amdmi3.ru>
+ *
+ * This file is part of hoverboard-sdl.
+ *
+ * hoverboard-sdl is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * hoverboard-sdl is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with hoverboard-sdl.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef RLE_HH
+#define RLE_HH
+
+#include <cstddef>
+#include <vector>
+
+// Simple byte-oriented run-length compression (PackBits variant)
+//
+// Each chunk starts with control byte n:
+// - 0..127:   n + 1 literal bytes follow
+// - 129..255: next byte is repeated 257 - n times
+// - 128:      no-op
+//
+// Tiles mostly consist of large flat areas, so this compresses
+// them well, while decompression is basically memset/memcpy
+std::vector<unsigned char> RleCompress(const unsigned char* data, size_t size);
+
+// Appends decompressed data to output; returns false on malformed input
+bool RleDecompress(const unsigned char* data, size_t size, std::vector<unsigned char>& output);
+
+#endif // RLE_HH
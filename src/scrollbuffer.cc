@@ -0,0 +1,166 @@
+/*
+ * Copyright (C) 2015 Dmitry Marakasov <amdmi3@amdmi3.ru>
+ *
+ * This file is part of hoverboard-sdl.
+ *
+ * hoverboard-sdl is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * hoverboard-sdl is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with hoverboard-sdl.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "scrollbuffer.hh"
+
+#include <algorithm>
+
+#include <SDL_pixels.h>
+#include <SDL_render.h>
+
+constexpr int ScrollBuffer::granularity_;
+
+namespace {
+
+int Wrap(int value, int size) {
+	int wrapped = value % size;
+	return wrapped < 0 ? wrapped + size : wrapped;
+}
+
+}
+
+ScrollBuffer::ScrollBuffer(SDL2pp::Renderer& renderer, const SDL_Color& background)
+	: renderer_(renderer),
+	  background_(background) {
+}
+
+bool ScrollBuffer::Reserve(int width, int height) {
+	if (texture_ && width <= width_ && height <= height_)
+		return true;
+
+	if (!renderer_.TargetSupported())
+		return false;
+
+	int new_width = std::max(width_, (width + granularity_ - 1) / granularity_ * granularity_);
+	int new_height = std::max(height_, (height + granularity_ - 1) / granularity_ * granularity_);
+
+	// zero means there's no limit
+	SDL_RendererInfo info;
+	renderer_.GetInfo(info);
+	if (info.max_texture_width > 0)
+		new_width = std::min(new_width, info.max_texture_width);
+	if (info.max_texture_height > 0)
+		new_height = std::min(new_height, info.max_texture_height);
+
+	if (new_width < width || new_height < height)
+		return false;
+
+	// free old buffer before allocating larger one; its contents
+	// are laid out for old dimensions anyway
+	texture_ = SDL2pp::NullOpt;
+	texture_ = SDL2pp::Texture(renderer_, SDL_PIXELFORMAT_RGB888, SDL_TEXTUREACCESS_TARGET, new_width, new_height);
+	texture_->SetBlendMode(SDL_BLENDMODE_NONE);
+
+	width_ = new_width;
+	height_ = new_height;
+
+	Invalidate();
+
+	return true;
+}
+
+template<class F>
+void ScrollBuffer::ProcessPieces(const SDL2pp::Rect& rect, F processor) const {
+	// split world rect into pieces which do not cross buffer
+	// edges; processor gets each piece with its buffer position
+	for (int y = rect.y; y < rect.y + rect.h; ) {
+		int buffer_y = Wrap(y, height_);
+		int h = std::min(rect.y + rect.h - y, height_ - buffer_y);
+
+		for (int x = rect.x; x < rect.x + rect.w; ) {
+			int buffer_x = Wrap(x, width_);
+			int w = std::min(rect.x + rect.w - x, width_ - buffer_x);
+
+			processor(SDL2pp::Rect(x, y, w, h), SDL2pp::Point(buffer_x, buffer_y));
+
+			x += w;
+		}
+
+		y += h;
+	}
+}
+
+bool ScrollBuffer::Render(const SDL2pp::Rect& rect, const DrawFunc& draw) {
+	if (!Reserve(rect.w, rect.h))
+		return false;
+
+	// areas to draw are these not present in the buffer, and
+	// these which have changed in the part which is
+	std::vector<SDL2pp::Rect> areas;
+	if (auto kept = rect.GetIntersection(valid_rect_)) {
+		if (kept->y > rect.y)
+			areas.emplace_back(rect.x, rect.y, rect.w, kept->y - rect.y);
+		if (kept->y + kept->h < rect.y + rect.h)
+			areas.emplace_back(rect.x, kept->y + kept->h, rect.w, rect.y + rect.h - kept->y - kept->h);
+		if (kept->x > rect.x)
+			areas.emplace_back(rect.x, kept->y, kept->x - rect.x, kept->h);
+		if (kept->x + kept->w < rect.x + rect.w)
+			areas.emplace_back(kept->x + kept->w, kept->y, rect.x + rect.w - kept->x - kept->w, kept->h);
+
+		for (auto& dirty_rect : dirty_rects_)
+			if (auto dirty_area = dirty_rect.GetIntersection(*kept))
+				areas.emplace_back(*dirty_area);
+	} else {
+		areas.emplace_back(rect);
+	}
+
+	dirty_rects_.clear();
+	valid_rect_ = rect;
+
+	if (!areas.empty()) {
+		renderer_.SetTarget(*texture_);
+
+		for (auto& area : areas) {
+			ProcessPieces(area, [&](const SDL2pp::Rect& piece, const SDL2pp::Point& buffer_pos) {
+					SDL2pp::Rect buffer_rect(buffer_pos, piece.GetSize());
+
+					// clip, so drawing doesn't spill over valid
+					// content around, or wrap to the other side
+					renderer_.SetClipRect(buffer_rect);
+
+					// drawn tiles may have changed the color
+					renderer_.SetDrawColor(background_.r, background_.g, background_.b, background_.a);
+					renderer_.FillRect(buffer_rect);
+
+					draw(piece, SDL2pp::Rect(piece.GetTopLeft() - buffer_pos, buffer_pos + piece.GetSize()));
+				});
+		}
+
+		renderer_.SetClipRect();
+		renderer_.SetTarget();
+	}
+
+	ProcessPieces(rect, [&](const SDL2pp::Rect& piece, const SDL2pp::Point& buffer_pos) {
+			renderer_.Copy(*texture_, SDL2pp::Rect(buffer_pos, piece.GetSize()), piece - rect.GetTopLeft());
+		});
+
+	return true;
+}
+
+void ScrollBuffer::Invalidate(const SDL2pp::Rect& rect) {
+	// areas outside of the buffer are drawn anyway when these
+	// become visible
+	if (rect.Intersects(valid_rect_))
+		dirty_rects_.emplace_back(rect);
+}
+
+void ScrollBuffer::Invalidate() {
+	valid_rect_ = SDL2pp::Rect();
+	dirty_rects_.clear();
+}
@@ -0,0 +1,87 @@
+/*
+ * Copyright (C) 2015 Dmitry Marakasov <amdmi3@amdmi3.ru>
+ *
+ * This file is part of hoverboard-sdl.
+ *
+ * hoverboard-sdl is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * hoverboard-sdl is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with hoverboard-sdl.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SCROLLBUFFER_HH
+#define SCROLLBUFFER_HH
+
+#include <functional>
+#include <vector>
+
+#include <SDL2pp/Optional.hh>
+#include <SDL2pp/Rect.hh>
+#include <SDL2pp/Renderer.hh>
+#include <SDL2pp/Texture.hh>
+
+// Offscreen copy of static part of the view, reused across frames
+//
+// Buffer is toroidal: world pixel (x, y) is stored at (x mod width,
+// y mod height), so when the view scrolls, content which stays
+// visible stays in place, and only newly exposed strips (and areas
+// explicitly invalidated) have to be drawn. The view is then put
+// on screen with a single copy, or up to four where it wraps
+// around buffer edges.
+class ScrollBuffer {
+public:
+	// should draw given world area with viewport offset, that is
+	// world point viewport.x, viewport.y goes to target origin
+	typedef std::function<void(const SDL2pp::Rect& area, const SDL2pp::Rect& viewport)> DrawFunc;
+
+private:
+	// buffer dimensions are rounded up to this, so small
+	// changes of view size do not cause reallocations
+	static constexpr int granularity_ = 64;
+
+private:
+	SDL2pp::Renderer& renderer_;
+	const SDL_Color background_;
+
+	SDL2pp::Optional<SDL2pp::Texture> texture_;
+	int width_ = 0;
+	int height_ = 0;
+
+	// world area buffer currently holds, and parts of it which
+	// have changed since it was drawn
+	SDL2pp::Rect valid_rect_;
+	std::vector<SDL2pp::Rect> dirty_rects_;
+
+private:
+	bool Reserve(int width, int height);
+
+	template<class F>
+	void ProcessPieces(const SDL2pp::Rect& rect, F processor) const;
+
+public:
+	ScrollBuffer(SDL2pp::Renderer& renderer, const SDL_Color& background);
+
+	ScrollBuffer(const ScrollBuffer&) = delete;
+	ScrollBuffer& operator=(const ScrollBuffer&) = delete;
+
+	// rect is in world coordinates; returns false if the buffer
+	// can't be used (render targets not supported, or view too
+	// large), in which case caller should draw the view directly
+	bool Render(const SDL2pp::Rect& rect, const DrawFunc& draw);
+
+	// marks world area as needing redraw
+	void Invalidate(const SDL2pp::Rect& rect);
+
+	// drops all buffer contents, e.g. when render targets are lost
+	void Invalidate();
+};
+
+#endif // SCROLLBUFFER_HH
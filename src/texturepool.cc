@@ -0,0 +1,84 @@
+/*
+ * Copyright (C) 2015 Dmitry Marakasov <amdmi3@amdmi3.ru>
+ *
+ * This file is part of hoverboard-sdl.
+ *
+ * hoverboard-sdl is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * hoverboard-sdl is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with hoverboard-sdl.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "texturepool.hh"
+
+#include <algorithm>
+
+#include <SDL_pixels.h>
+
+TexturePool::TexturePool(SDL2pp::Renderer& renderer, Uint32 format, int access, int width, int height, size_t max_idle)
+	: renderer_(renderer),
+	  format_(format),
+	  access_(access),
+	  width_(width),
+	  height_(height),
+	  max_idle_(max_idle) {
+}
+
+SDL2pp::Texture TexturePool::Acquire() {
+	stats_.in_use++;
+	stats_.peak_in_use = std::max(stats_.peak_in_use, stats_.in_use);
+
+	if (!idle_.empty()) {
+		SDL2pp::Texture texture = std::move(idle_.back());
+		idle_.pop_back();
+
+		stats_.reused++;
+		stats_.idle = idle_.size();
+		return texture;
+	}
+
+	stats_.created++;
+	return SDL2pp::Texture(renderer_, format_, access_, width_, height_);
+}
+
+void TexturePool::Release(SDL2pp::Texture&& texture) {
+	if (!texture.Get())
+		return; // moved-from texture, nothing to return
+
+	stats_.in_use--;
+
+	if (idle_.size() < max_idle_) {
+		idle_.emplace_back(std::move(texture));
+		stats_.idle = idle_.size();
+	} else {
+		stats_.discarded++;
+	}
+}
+
+void TexturePool::Trim(size_t max_bytes) {
+	while (!idle_.empty() && GetTextureBytes() > max_bytes) {
+		idle_.pop_back();
+		stats_.discarded++;
+	}
+	stats_.idle = idle_.size();
+}
+
+int TexturePool::GetAccess() const {
+	return access_;
+}
+
+size_t TexturePool::GetTextureBytes() const {
+	return idle_.size() * width_ * height_ * SDL_BYTESPERPIXEL(format_);
+}
+
+const TexturePool::Stats& TexturePool::GetStats() const {
+	return stats_;
+}
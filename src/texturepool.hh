@@ -0,0 +1,75 @@
+/*
+ * Copyright (C) 2015 Dmitry Marakasov <amdmi3@amdmi3.ru>
+ *
+ * This file is part of hoverboard-sdl.
+ *
+ * hoverboard-sdl is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * hoverboard-sdl is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with hoverboard-sdl.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef TEXTUREPOOL_HH
+#define TEXTUREPOOL_HH
+
+#include <vector>
+
+#include <SDL2pp/Renderer.hh>
+#include <SDL2pp/Texture.hh>
+
+// Pool of same-sized textures, which lets us avoid creating and
+// destroying textures each time a tile is uploaded or evicted
+class TexturePool {
+public:
+	struct Stats {
+		size_t created = 0;      // textures ever created
+		size_t reused = 0;       // acquisitions satisfied from the pool
+		size_t discarded = 0;    // released textures destroyed because pool was full
+		size_t in_use = 0;       // textures currently acquired
+		size_t peak_in_use = 0;  // high-water mark of in_use
+		size_t idle = 0;         // textures currently sitting in the pool
+	};
+
+private:
+	SDL2pp::Renderer& renderer_;
+
+	const Uint32 format_;
+	const int access_;
+	const int width_;
+	const int height_;
+
+	const size_t max_idle_;  // unused textures kept in the pool
+
+	std::vector<SDL2pp::Texture> idle_;
+
+	Stats stats_;
+
+public:
+	TexturePool(SDL2pp::Renderer& renderer, Uint32 format, int access, int width, int height, size_t max_idle);
+
+	TexturePool(const TexturePool&) = delete;
+	TexturePool& operator=(const TexturePool&) = delete;
+
+	// textures are returned in undefined state, caller
+	// is expected to overwrite all their contents
+	SDL2pp::Texture Acquire();
+	void Release(SDL2pp::Texture&& texture);
+
+	// drops unused textures until they take no more than max_bytes
+	void Trim(size_t max_bytes);
+
+	int GetAccess() const;
+
+	size_t GetTextureBytes() const;
+	const Stats& GetStats() const;
+};
+
+#endif // TEXTUREPOOL_HH
@@ -22,14 +22,61 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 
+#include <algorithm>
 #include <cassert>
+#include <cstring>
 #include <sstream>
+#include <stdexcept>
 
 #include <SDL_surface.h>
 #include <SDL_render.h>
+#include <SDL_rwops.h>
+#include <SDL2pp/RWops.hh>
 #include <SDL2pp/Surface.hh>
 
 #include "collision.hh"
+#include "rle.hh"
+#include "tilearchive.hh"
+
+namespace {
+
+uint64_t HashWords(uint64_t hash, const unsigned char* data, size_t size) {
+	for (size_t i = 0; i + 8 <= size; i += 8) {
+		uint64_t word;
+		std::memcpy(&word, data + i, 8);
+		hash = (hash ^ word) * 0x9e3779b97f4a7c15ULL;
+		hash ^= hash >> 29;
+	}
+	return hash;
+}
+
+uint64_t HashContent(const void* palette, size_t palette_size, const unsigned char* pixels, size_t pixels_size) {
+	uint64_t hash = HashWords(0xcbf29ce484222325ULL, static_cast<const unsigned char*>(palette), palette_size);
+	hash = HashWords(hash, pixels, pixels_size);
+
+	// final avalanche (from MurmurHash3), so all bits are usable
+	hash ^= hash >> 33;
+	hash *= 0xff51afd7ed558ccdULL;
+	hash ^= hash >> 33;
+	hash *= 0xc4ceb9fe1a85ec53ULL;
+	hash ^= hash >> 33;
+
+	return hash != 0 ? hash : 1; // 0 is reserved for no content
+}
+
+std::vector<unsigned char> CompressContent(const void* palette, size_t palette_size, const unsigned char* pixels, size_t pixels_size) {
+	std::vector<unsigned char> content(palette_size + pixels_size);
+	std::memcpy(content.data(), palette, palette_size);
+	std::memcpy(content.data() + palette_size, pixels, pixels_size);
+	return RleCompress(content.data(), content.size());
+}
+
+void Checkpoint(const Tile::CancelCheck& cancel_check) {
+	if (cancel_check && cancel_check())
+		throw Tile::LoadCancelled();
+}
+
+}
 
 std::string Tile::MakeTilePath(const SDL2pp::Point& coords) {
 	std::stringstream filename;
@@ -37,76 +84,181 @@ std::string Tile::MakeTilePath(const SDL2pp::Point& coords) {
 	return filename.str();
 }
 
-Tile::Tile(const SDL2pp::Point& coords)
+const char* Tile::LoadCancelled::what() const noexcept {
+	return "tile load cancelled";
+}
+
+Tile::Tile(const SDL2pp::Point& coords, const TileArchive& archive, Layers layers, const CancelCheck& cancel_check)
 	: coords_(coords) {
+	if (archive.IsOpen()) {
+		// decode straight from mapped archive
+		auto blob = archive.Find(coords);
+		if (!blob) {
+			InitEmpty();
+			return;
+		}
+
+		// the request may have gone stale while waiting for
+		// the read, and decoding is the most expensive part
+		Checkpoint(cancel_check);
+
+		if (archive.GetFormat() == TileArchive::Format::RAW) {
+			InitFromRaw(blob->data, blob->size, layers, cancel_check);
+			return;
+		}
+
+		SDL2pp::RWops rwops(SDL_RWFromConstMem(blob->data, (int)blob->size));
+		SDL2pp::Surface surface(rwops);
+		Checkpoint(cancel_check);
+		InitFromSurface(surface, layers, cancel_check);
+		return;
+	}
+
 	std::string path = MakeTilePath(coords).c_str();
 	struct stat st;
 	if (stat(path.c_str(), &st) != 0) {
-		visual_data_.reset(new NoVisual);
-		obstacle_data_.reset(new NoObstacle);
+		InitEmpty();
 		return;
 	}
 
-	// temporary surface for image loading
+	Checkpoint(cancel_check);
+
 	SDL2pp::Surface surface(path);
+	Checkpoint(cancel_check);
+	InitFromSurface(surface, layers, cancel_check);
+}
+
+Tile::Tile(const SDL2pp::Point& coords, std::vector<unsigned char>&& compressed)
+	: coords_(coords), compressed_(std::move(compressed)) {
+	std::vector<unsigned char> raw;
+	raw.reserve(raw_header_size_ + raw_pixels_size_);
+
+	if (!RleDecompress(compressed_.data(), compressed_.size(), raw))
+		throw std::runtime_error("malformed compressed tile");
+
+	InitFromRaw(raw.data(), raw.size(), Layers::ALL, CancelCheck());
+}
+
+Tile::Tile(const SDL2pp::Point& coords, const unsigned char* raw, size_t size, Layers layers)
+	: coords_(coords) {
+	InitFromRaw(raw, size, layers, CancelCheck());
+}
+
+void Tile::InitEmpty() {
+	visual_data_.reset(new NoVisual);
+	obstacle_data_.reset(new NoObstacle);
+}
+
+void Tile::InitFromSurface(SDL2pp::Surface& surface, Layers layers, const CancelCheck& cancel_check) {
 	assert(surface.GetWidth() >= tile_size_ && surface.GetHeight() >= tile_size_);
 
 	SDL2pp::Surface::LockHandle lock = surface.Lock();
 
 	// we only support palettes which tiles by fact are
-	SDL_Color* palette = surface.Get()->format->palette ? surface.Get()->format->palette->colors : nullptr;
+	SDL_Palette* palette = surface.Get()->format->palette;
 	assert(palette);
 	assert(lock.GetFormat().BytesPerPixel == 1);
 
-	// read pixels
-	PixelVisual::PixelData pixels;
-	ObstacleMap::Map obstacle_map;
-	pixels.reserve(tile_size_ * tile_size_ * 4);
-	obstacle_map.reserve(tile_size_ * tile_size_);
-
-	unsigned char* line = static_cast<unsigned char*>(lock.GetPixels());
-	unsigned char* pixel = line;
-	SDL_Color default_color{ palette[*pixel].r, palette[*pixel].g, palette[*pixel].b, palette[*pixel].a };
-	bool default_obstacle = IsObstacle(palette[*pixel].r);
-	bool same_color = true;
-	bool same_obstacle = true;
-	for (int y = 0; y < tile_size_; y++) {
-		for (int x = 0; x < tile_size_; x++) {
-			pixels.push_back(palette[*pixel].r);
-			pixels.push_back(palette[*pixel].g);
-			pixels.push_back(palette[*pixel].b);
-			pixels.push_back(palette[*pixel].a);
+	// palette may be shorter than 256 colors
+	SDL_Color full_palette[256] = {};
+	std::copy(palette->colors, palette->colors + std::min(palette->ncolors, 256), full_palette);
+
+	const unsigned char* pixels = static_cast<const unsigned char*>(lock.GetPixels());
 
-			obstacle_map.push_back(IsObstacle(palette[*pixel].r));
+	Classification cls = Classify(full_palette, pixels, lock.GetPitch());
 
-			if (true && (
-					palette[*pixel].r != default_color.r ||
-					palette[*pixel].g != default_color.g ||
-					palette[*pixel].b != default_color.b ||
-					palette[*pixel].a != default_color.a
-			   ))
-				same_color = false;
+	InitFromIndexed(cls, full_palette, pixels, lock.GetPitch(), layers, cancel_check);
+
+	// decoding PNG is expensive, so keep compressed indices for
+	// tiles with pixel data, see TileCache evicted tiles
+	if (!cls.same_color && layers == Layers::ALL) {
+		Checkpoint(cancel_check);
+
+		std::vector<unsigned char> raw = EncodeRaw(cls, full_palette, pixels, lock.GetPitch());
+		compressed_ = RleCompress(raw.data(), raw.size());
+	}
+}
+
+Tile::Classification Tile::Classify(const SDL_Color* palette, const unsigned char* pixels, int pitch) {
+	Classification result;
+
+	const SDL_Color& default_color = palette[*pixels];
+	result.color = default_color;
+	result.obstacle = IsObstacle(default_color.r);
+
+	// per-palette entry lookup tables, so we only compare indices below
+	bool same_color_lut[256], same_obstacle_lut[256];
+	for (int i = 0; i < 256; i++) {
+		same_color_lut[i] =
+			palette[i].r == default_color.r &&
+			palette[i].g == default_color.g &&
+			palette[i].b == default_color.b &&
+			palette[i].a == default_color.a;
+		same_obstacle_lut[i] = IsObstacle(palette[i].r) == result.obstacle;
+	}
 
-			if (true && IsObstacle(palette[*pixel].r) != default_obstacle)
-				same_obstacle = false;
+	result.same_color = true;
+	result.same_obstacle = true;
 
-			pixel++;
+	const unsigned char* line = pixels;
+	for (int y = 0; y < tile_size_ && (result.same_color || result.same_obstacle); y++, line += pitch) {
+		for (int x = 0; x < tile_size_; x++) {
+			result.same_color = result.same_color && same_color_lut[line[x]];
+			result.same_obstacle = result.same_obstacle && same_obstacle_lut[line[x]];
 		}
-		pixel = (line += lock.GetPitch());
 	}
 
+	return result;
+}
+
+void Tile::InitFromIndexed(const Classification& cls, const SDL_Color* palette, const unsigned char* pixels, int pitch, Layers layers, const CancelCheck& cancel_check) {
 	// determine mode and save data
-	if (same_color)
-		visual_data_.reset(new SolidVisual(default_color));
-	else
-		visual_data_.reset(new PixelVisual(std::move(pixels)));
+	if (layers == Layers::OBSTACLES || (cls.same_color && cls.color.a == 0)) {
+		visual_data_.reset(new NoVisual);
+	} else if (cls.same_color) {
+		visual_data_.reset(new SolidVisual(cls.color));
+	} else {
+		PixelVisual::Palette argb_palette;
+		for (int i = 0; i < 256; i++)
+			argb_palette[i] = (Uint32)palette[i].a << 24 | (Uint32)palette[i].r << 16 | (Uint32)palette[i].g << 8 | (Uint32)palette[i].b;
+
+		PixelVisual::IndexData indices(tile_size_ * tile_size_);
+		for (int y = 0; y < tile_size_; y++)
+			std::memcpy(indices.data() + y * tile_size_, pixels + y * pitch, tile_size_);
 
-	if (same_obstacle && default_obstacle)
+		if (layers == Layers::ALL) {
+			content_hash_ = HashContent(argb_palette.data(), sizeof(argb_palette), indices.data(), indices.size());
+			content_ = std::make_shared<const Content>(CompressContent(argb_palette.data(), sizeof(argb_palette), indices.data(), indices.size()));
+		}
+
+		visual_data_.reset(new PixelVisual(std::move(indices), argb_palette));
+	}
+
+	if (layers == Layers::VISUALS) {
+		obstacle_data_.reset(new NoObstacle());
+	} else if (cls.same_obstacle && cls.obstacle) {
 		obstacle_data_.reset(new SolidObstacle());
-	else if (same_obstacle && !default_obstacle)
+	} else if (cls.same_obstacle && !cls.obstacle) {
 		obstacle_data_.reset(new NoObstacle());
-	else
-		obstacle_data_.reset(new ObstacleMap(std::move(obstacle_map)));
+	} else {
+		bool lut[256];
+		for (int i = 0; i < 256; i++)
+			lut[i] = IsObstacle(palette[i].r);
+
+		ObstacleMap::Bits obstacle_bits(tile_size_ * ObstacleMap::words_per_line_);
+
+		const unsigned char* line = pixels;
+		for (int y = 0; y < tile_size_; y++, line += pitch) {
+			if (y % 64 == 0)
+				Checkpoint(cancel_check);
+
+			uint64_t* bits = obstacle_bits.data() + y * ObstacleMap::words_per_line_;
+			for (int x = 0; x < tile_size_; x++)
+				bits[x / 64] |= (uint64_t)lut[line[x]] << (x % 64);
+		}
+
+		obstacle_data_.reset(new ObstacleMap(std::move(obstacle_bits)));
+	}
 }
 
 Tile::~Tile() {
@@ -128,17 +280,46 @@ SDL2pp::Rect Tile::GetRect() const {
 	return RectForCoords(coords_);
 }
 
+size_t Tile::GetCpuBytes() const {
+	size_t bytes = sizeof(*this) + compressed_.capacity();
+	if (content_.use_count() == 1)
+		bytes += content_->capacity();
+	if (visual_data_.use_count() == 1)
+		bytes += visual_data_->GetCpuBytes();
+	if (obstacle_data_.use_count() == 1)
+		bytes += obstacle_data_->GetCpuBytes();
+	return bytes;
+}
+
+size_t Tile::GetTextureBytes() const {
+	return visual_data_.use_count() == 1 ? visual_data_->GetTextureBytes() : 0;
+}
+
+bool Tile::HasCompressed() const {
+	return !compressed_.empty();
+}
+
+std::vector<unsigned char> Tile::TakeCompressed() {
+	std::vector<unsigned char> result;
+	result.swap(compressed_);
+	return result;
+}
+
 bool Tile::NeedsUpgrade() const {
 	return visual_data_->NeedsUpgrade();
 }
 
-void Tile::Upgrade(SDL2pp::Renderer& renderer) {
+void Tile::Upgrade(TexturePool& pool) {
 	if (visual_data_->NeedsUpgrade()) {
-		auto upgrade = visual_data_->Upgrade(renderer);
+		auto upgrade = visual_data_->Upgrade(pool);
 		visual_data_ = std::move(upgrade);
 	}
 }
 
+void Tile::Downsample(int level, Uint32* output, int pitch) const {
+	visual_data_->Downsample(level, output, pitch);
+}
+
 void Tile::Render(SDL2pp::Renderer& renderer, const SDL2pp::Rect& viewport) {
 	if (!GetRect().Intersects(viewport))
 		return;
@@ -165,3 +346,50 @@ void Tile::CheckBottomCollision(CollisionInfo& coll, const SDL2pp::Rect& rect) c
 	if (auto real_rect = rect.GetIntersection(GetRect()))
 		obstacle_data_->CheckBottomCollision(coll, *real_rect - GetRect().GetTopLeft(), GetRect().GetTopLeft());
 }
+
+void Tile::ContentRegistry::Share(Tile& tile) {
+	if (tile.content_hash_ == 0)
+		return;
+
+	Entry& entry = entries_[tile.content_hash_];
+
+	// obstacles are derived from palette and pixels, so comparing
+	// these covers obstacle data as well
+	std::shared_ptr<const Content> content = entry.content.lock();
+	if (!content) {
+		entry.content = tile.content_;
+		entry.visual = tile.visual_data_;
+		entry.obstacle = tile.obstacle_data_;
+		return;
+	}
+
+	if (content != tile.content_) {
+		if (*content != *tile.content_)
+			return;  // hash collision, tile keeps its own content
+		tile.content_ = content;
+	}
+
+	std::shared_ptr<VisualData> visual = entry.visual.lock();
+	if (visual && (!visual->NeedsUpgrade() || tile.visual_data_->NeedsUpgrade()))
+		tile.visual_data_ = visual;
+	else
+		entry.visual = tile.visual_data_;
+
+	if (std::shared_ptr<ObstacleData> obstacle = entry.obstacle.lock())
+		tile.obstacle_data_ = obstacle;
+	else
+		entry.obstacle = tile.obstacle_data_;
+}
+
+void Tile::ContentRegistry::Purge() {
+	for (auto entry = entries_.begin(); entry != entries_.end(); ) {
+		if (entry->second.content.expired())
+			entry = entries_.erase(entry);
+		else
+			++entry;
+	}
+}
+
+size_t Tile::ContentRegistry::GetSize() const {
+	return entries_.size();
+}
@@ -20,19 +20,53 @@
 #ifndef TILE_HH
 #define TILE_HH
 
+#include <array>
 #include <vector>
 #include <memory>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <unordered_map>
 
 #include <SDL2pp/Point.hh>
 #include <SDL2pp/Renderer.hh>
 #include <SDL2pp/Texture.hh>
+#include <SDL2pp/Surface.hh>
 
 class CollisionInfo;
+class TileArchive;
+class TexturePool;
 
 class Tile {
 public:
 	static constexpr int tile_size_ = 512;
 
+	// size of pre-decoded tile header, see EncodeRaw; tiles
+	// without pixel data consist of the header alone
+	static constexpr size_t raw_header_size_ = 6;
+
+	// Parts of the tile to set up. Physics only needs obstacle data,
+	// which is much cheaper to build than visuals, so tiles loaded
+	// for it may skip visuals altogether (these are left empty), and
+	// tiles which are only downsampled skip obstacle data, content
+	// hash and compressed copy
+	enum class Layers {
+		ALL,
+		OBSTACLES,
+		VISUALS,
+	};
+
+	// Loading may be abandoned midway: cancel check is called at a
+	// few checkpoints (after the tile is read and decoded, and
+	// between batches of rows when processing it), and once it
+	// returns true, loading stops by throwing LoadCancelled
+	typedef std::function<bool()> CancelCheck;
+
+	class LoadCancelled : public std::exception {
+	public:
+		virtual const char* what() const noexcept final;
+	};
+
 private:
 	// obstacle aspects
 	class ObstacleData {
@@ -43,6 +77,8 @@ private:
 		virtual void CheckRightCollision(CollisionInfo& coll, const SDL2pp::Rect& localrect, const SDL2pp::Point& offset) const = 0;
 		virtual void CheckTopCollision(CollisionInfo& coll, const SDL2pp::Rect& localrect, const SDL2pp::Point& offset) const = 0;
 		virtual void CheckBottomCollision(CollisionInfo& coll, const SDL2pp::Rect& localrect, const SDL2pp::Point& offset) const = 0;
+
+		virtual size_t GetCpuBytes() const = 0;
 	};
 
 	class NoObstacle : public ObstacleData {
@@ -53,6 +89,8 @@ private:
 		virtual void CheckRightCollision(CollisionInfo& coll, const SDL2pp::Rect& localrect, const SDL2pp::Point& offset) const final;
 		virtual void CheckTopCollision(CollisionInfo& coll, const SDL2pp::Rect& localrect, const SDL2pp::Point& offset) const final;
 		virtual void CheckBottomCollision(CollisionInfo& coll, const SDL2pp::Rect& localrect, const SDL2pp::Point& offset) const final;
+
+		virtual size_t GetCpuBytes() const final;
 	};
 
 	class SolidObstacle : public ObstacleData {
@@ -64,23 +102,66 @@ private:
 		virtual void CheckRightCollision(CollisionInfo& coll, const SDL2pp::Rect& localrect, const SDL2pp::Point& offset) const final;
 		virtual void CheckTopCollision(CollisionInfo& coll, const SDL2pp::Rect& localrect, const SDL2pp::Point& offset) const final;
 		virtual void CheckBottomCollision(CollisionInfo& coll, const SDL2pp::Rect& localrect, const SDL2pp::Point& offset) const final;
+
+		virtual size_t GetCpuBytes() const final;
 	};
 
 	class ObstacleMap : public ObstacleData {
 	public:
-		typedef std::vector<bool> Map;
+		// one bit per pixel, packed into 64 bit words, row by row
+		typedef std::vector<uint64_t> Bits;
+
+		static constexpr int words_per_line_ = tile_size_ / 64;
+		static constexpr int blocks_per_line_ = tile_size_ / 64;
+
+		static_assert(tile_size_ % 64 == 0, "tile size must be a multiple of 64");
+		static_assert(blocks_per_line_ * blocks_per_line_ <= 64, "block summary must fit a single word");
 
 	private:
-		Map map_;
+		// first and last obstacle pixel in a row or column; empty
+		// lines have first = tile_size_, last = -1, so any range
+		// check against them fails
+		struct LineSummary {
+			int16_t first = tile_size_;
+			int16_t last = -1;
+		};
+
+		// obstacle bits, both row-major (scanned by top/bottom checks)
+		// and column-major (scanned by left/right checks), so that
+		// all checks walk whole words instead of single pixels
+		Bits rows_;
+		Bits columns_;
+
+		std::array<LineSummary, tile_size_> row_summary_;
+		std::array<LineSummary, tile_size_> column_summary_;
+
+		// one bit per 64x64 block, set if the block has any obstacle
+		uint64_t blocks_ = 0;
+
+	private:
+		bool MayIntersect(const SDL2pp::Rect& localrect) const;
+
+		// Nearest obstacle queries. Each one walks either lines across
+		// the direction of movement (which allows stopping at the first
+		// hit), or, for rects more than twice as long as wide, lines
+		// along it, and answers each line with a summary lookup or
+		// a scan of at most words_per_line_ words, so cost doesn't
+		// grow with how far the rect extends
+		bool FindRightmost(const SDL2pp::Rect& localrect, SDL2pp::Point& result) const;
+		bool FindLeftmost(const SDL2pp::Rect& localrect, SDL2pp::Point& result) const;
+		bool FindBottommost(const SDL2pp::Rect& localrect, int& result) const;
+		bool FindTopmost(const SDL2pp::Rect& localrect, int& result) const;
 
 	public:
-		ObstacleMap(Map&& map);
+		ObstacleMap(Bits&& rows);
 		virtual ~ObstacleMap();
 
 		virtual void CheckLeftCollision(CollisionInfo& coll, const SDL2pp::Rect& localrect, const SDL2pp::Point& offset) const final;
 		virtual void CheckRightCollision(CollisionInfo& coll, const SDL2pp::Rect& localrect, const SDL2pp::Point& offset) const final;
 		virtual void CheckTopCollision(CollisionInfo& coll, const SDL2pp::Rect& localrect, const SDL2pp::Point& offset) const final;
 		virtual void CheckBottomCollision(CollisionInfo& coll, const SDL2pp::Rect& localrect, const SDL2pp::Point& offset) const final;
+
+		virtual size_t GetCpuBytes() const final;
 	};
 
 	// visual aspects
@@ -91,14 +172,21 @@ private:
 		virtual ~VisualData();
 		virtual void Render(SDL2pp::Renderer& renderer, const SDL2pp::Point& offset) = 0;
 
+		virtual size_t GetCpuBytes() const = 0;
+		virtual size_t GetTextureBytes() const;
+
 		virtual bool NeedsUpgrade() const;
-		virtual std::unique_ptr<TextureVisual> Upgrade(SDL2pp::Renderer& renderer) const;
+		virtual std::unique_ptr<TextureVisual> Upgrade(TexturePool& pool) const;
+
+		// default is transparent
+		virtual void Downsample(int level, Uint32* output, int pitch) const;
 	};
 
 	class NoVisual : public VisualData {
 	public:
 		virtual ~NoVisual();
 		virtual void Render(SDL2pp::Renderer& renderer, const SDL2pp::Point& offset) final;
+		virtual size_t GetCpuBytes() const final;
 	};
 
 	class SolidVisual : public VisualData {
@@ -109,40 +197,67 @@ private:
 		SolidVisual(const SDL_Color& color);
 		virtual ~SolidVisual();
 		virtual void Render(SDL2pp::Renderer& renderer, const SDL2pp::Point& offset) final;
+		virtual size_t GetCpuBytes() const final;
+		virtual void Downsample(int level, Uint32* output, int pitch) const final;
 	};
 
+	// Tile pixels not yet uploaded into texture; these are kept as
+	// palette indices (1/4 of expanded size), and are only expanded
+	// to ARGB when uploading
 	class PixelVisual : public VisualData {
 	public:
-		typedef std::vector<unsigned char> PixelData;
+		typedef std::vector<unsigned char> IndexData;
+		typedef std::array<Uint32, 256> Palette;  // ARGB8888
 
 	private:
-		PixelData pixels_;
+		IndexData indices_;
+		Palette palette_;
 
 	public:
-		PixelVisual(PixelData&& pixels);
+		PixelVisual(IndexData&& indices, const Palette& palette);
 		virtual ~PixelVisual();
 
 		virtual void Render(SDL2pp::Renderer& renderer, const SDL2pp::Point& offset) final;
+		virtual size_t GetCpuBytes() const final;
 		virtual bool NeedsUpgrade() const final;
-		virtual std::unique_ptr<TextureVisual> Upgrade(SDL2pp::Renderer& renderer) const final;
+		virtual std::unique_ptr<TextureVisual> Upgrade(TexturePool& pool) const final;
+		virtual void Downsample(int level, Uint32* output, int pitch) const final;
 	};
 
 	class TextureVisual : public VisualData {
 	private:
+		TexturePool& pool_;
 		SDL2pp::Texture texture_;
 
 	public:
-		TextureVisual(SDL2pp::Renderer& renderer, const PixelVisual::PixelData& pixels);
+		// texture is returned to the pool on destruction
+		TextureVisual(TexturePool& pool, const PixelVisual::IndexData& indices, const PixelVisual::Palette& palette);
 		virtual ~TextureVisual();
 
 		virtual void Render(SDL2pp::Renderer& renderer, const SDL2pp::Point& offset) final;
+		virtual size_t GetCpuBytes() const final;
+		virtual size_t GetTextureBytes() const final;
 	};
 
 private:
 	SDL2pp::Point coords_;
 
-	std::unique_ptr<VisualData> visual_data_;
-	std::unique_ptr<ObstacleData> obstacle_data_;
+	// may be shared between tiles with identical content, see
+	// ContentRegistry
+	std::shared_ptr<VisualData> visual_data_;
+	std::shared_ptr<ObstacleData> obstacle_data_;
+
+	// hash of palette and pixels, 0 for tiles without pixel data
+	uint64_t content_hash_ = 0;
+
+	// RLE compressed palette and pixels, which are compared when
+	// hashes match; shared between tiles with identical content
+	typedef std::vector<unsigned char> Content;
+	std::shared_ptr<const Content> content_;
+
+	// RLE compressed pre-decoded tile, kept for tiles which were
+	// expensive to decode so they can be cheaply restored later
+	std::vector<unsigned char> compressed_;
 
 private:
 	constexpr static int FloorDiv(int a, int b) {
@@ -154,14 +269,100 @@ private:
 		return color < 100 && !(color & 1);
 	}
 
+	// Properties of the whole tile which let us pick cheaper
+	// visual and obstacle representations
+	struct Classification {
+		bool same_color;
+		bool same_obstacle;
+		SDL_Color color;    // if same_color
+		bool obstacle;      // if same_obstacle
+	};
+
+	// Pre-decoded tile format, used in raw tile archives:
+	//
+	//   uint8    visual kind (RawVisual)
+	//   uint8    obstacle kind (RawObstacle)
+	//   uint8[4] color (RGBA) for solid tiles
+	//   uint8[4] 256-entry RGBA palette        \ only present for
+	//   uint8    tile_size_^2 palette indices  / RawVisual::PIXELS
+	enum RawVisual : unsigned char {
+		RAW_VISUAL_NONE = 0,
+		RAW_VISUAL_SOLID = 1,
+		RAW_VISUAL_PIXELS = 2,
+	};
+
+	enum RawObstacle : unsigned char {
+		RAW_OBSTACLE_NONE = 0,
+		RAW_OBSTACLE_SOLID = 1,
+		RAW_OBSTACLE_MAP = 2,
+	};
+
+	static constexpr size_t raw_pixels_size_ = 256 * 4 + tile_size_ * tile_size_;
+
+private:
 	static std::string MakeTilePath(const SDL2pp::Point& coords);
 
+	static Classification Classify(const SDL_Color* palette, const unsigned char* pixels, int pitch);
+	static std::vector<unsigned char> EncodeRaw(const Classification& cls, const SDL_Color* palette, const unsigned char* pixels, int pitch);
+
+	void InitEmpty();
+	void InitFromSurface(SDL2pp::Surface& surface, Layers layers, const CancelCheck& cancel_check);
+	void InitFromIndexed(const Classification& cls, const SDL_Color* palette, const unsigned char* pixels, int pitch, Layers layers, const CancelCheck& cancel_check);
+	void InitFromRaw(const unsigned char* data, size_t size, Layers layers, const CancelCheck& cancel_check);
+
+public:
+	// Tracks content (visual and obstacle data) of live tiles by
+	// content hash, so tiles with identical pixels share a single
+	// copy of it (and a single texture once it's uploaded) instead
+	// of holding their own. Tiles hold strong references, registry
+	// only holds weak ones
+	//
+	// Hash only selects the entry, content itself is compared before
+	// sharing, and a tile which collides with registered content of
+	// another kind just keeps its own
+	class ContentRegistry {
+	private:
+		struct Entry {
+			std::weak_ptr<const Content> content;
+			std::weak_ptr<VisualData> visual;
+			std::weak_ptr<ObstacleData> obstacle;
+		};
+
+		std::unordered_map<uint64_t, Entry> entries_;
+
+	public:
+		// makes tile use already registered content with the same
+		// hash, preferring uploaded visuals; registers tile's own
+		// content otherwise
+		void Share(Tile& tile);
+
+		// drops entries for content no tile uses anymore
+		void Purge();
+
+		size_t GetSize() const;
+	};
+
 public:
 	static SDL2pp::Point CoordsForPoint(const SDL2pp::Point& p);
 	static SDL2pp::Rect RectForCoords(const SDL2pp::Point& p);
 
+	// converts decoded tile image into pre-decoded format
+	static std::vector<unsigned char> EncodeRaw(SDL2pp::Surface& surface);
+
+	// whether pre-decoded tile header describes the whole tile
+	// (or given layers of it), e.g. tile may be constructed
+	// without decoding anything
+	static bool IsTrivialRaw(const unsigned char* header, Layers layers = Layers::ALL);
+
 public:
-	Tile(const SDL2pp::Point& coords);
+	// loads tile from the archive if it's open, from loose file otherwise
+	Tile(const SDL2pp::Point& coords, const TileArchive& archive, Layers layers = Layers::ALL, const CancelCheck& cancel_check = CancelCheck());
+
+	// restores tile from data previously returned by TakeCompressed()
+	Tile(const SDL2pp::Point& coords, std::vector<unsigned char>&& compressed);
+
+	// constructs tile from pre-decoded data
+	Tile(const SDL2pp::Point& coords, const unsigned char* raw, size_t size, Layers layers = Layers::ALL);
 	~Tile();
 
 	Tile(Tile&&) noexcept = default;
@@ -172,8 +373,23 @@ public:
 	SDL2pp::Point GetCoords() const;
 	SDL2pp::Rect GetRect() const;
 
+	// approximate memory footprint; shared content is only
+	// accounted by the tile which holds the last reference to it,
+	// so these sum up correctly over all tiles as long as sums are
+	// updated when tiles come and go
+	size_t GetCpuBytes() const;
+	size_t GetTextureBytes() const;
+
+	bool HasCompressed() const;
+	std::vector<unsigned char> TakeCompressed();
+
 	bool NeedsUpgrade() const;
-	void Upgrade(SDL2pp::Renderer& renderer);
+	void Upgrade(TexturePool& pool);
+
+	// renders tile image downsampled by 2^level into ARGB8888 buffer,
+	// see LevelTile; pixel data is gone after upgrade, so this is
+	// meant for freshly loaded tiles
+	void Downsample(int level, Uint32* output, int pitch) const;
 	void Render(SDL2pp::Renderer& renderer, const SDL2pp::Rect& viewport);
 
 	void CheckLeftCollision(CollisionInfo& coll, const SDL2pp::Rect& rect) const;
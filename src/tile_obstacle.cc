@@ -19,6 +19,12 @@
 
 #include "tile.hh"
 
+#if defined(_MSC_VER)
+#	include <intrin.h>
+#endif
+
+#include <algorithm>
+
 #include "collision.hh"
 
 Tile::ObstacleData::~ObstacleData() {
@@ -39,6 +45,10 @@ void Tile::NoObstacle::CheckTopCollision(CollisionInfo&, const SDL2pp::Rect&, co
 void Tile::NoObstacle::CheckBottomCollision(CollisionInfo&, const SDL2pp::Rect&, const SDL2pp::Point&) const {
 }
 
+size_t Tile::NoObstacle::GetCpuBytes() const {
+	return sizeof(*this);
+}
+
 Tile::SolidObstacle::SolidObstacle() {
 }
 
@@ -61,81 +71,275 @@ void Tile::SolidObstacle::CheckBottomCollision(CollisionInfo& coll, const SDL2pp
 	coll.AddBottomCollision(localrect.y + offset.y);
 }
 
-Tile::ObstacleMap::ObstacleMap(Map&& map) : map_(std::move(map)) {
+size_t Tile::SolidObstacle::GetCpuBytes() const {
+	return sizeof(*this);
+}
+
+namespace {
+
+// index of the lowest set bit of a non-zero word
+inline int LowestBit(uint64_t word) {
+#if defined(_MSC_VER)
+	unsigned long index;
+	_BitScanForward64(&index, word);
+	return (int)index;
+#else
+	return __builtin_ctzll(word);
+#endif
+}
+
+// index of the highest set bit of a non-zero word
+inline int HighestBit(uint64_t word) {
+#if defined(_MSC_VER)
+	unsigned long index;
+	_BitScanReverse64(&index, word);
+	return (int)index;
+#else
+	return 63 - __builtin_clzll(word);
+#endif
+}
+
+// bits [first % 64, last % 64] of the word which contains them
+inline uint64_t WordMask(int word, int first, int last) {
+	uint64_t mask = ~(uint64_t)0;
+	if (word == first / 64)
+		mask &= ~(uint64_t)0 << (first % 64);
+	if (word == last / 64)
+		mask &= ~(uint64_t)0 >> (63 - last % 64);
+	return mask;
+}
+
+// first set bit in [first, last] of a line of bits, or -1
+int FindFirstBit(const uint64_t* line, int first, int last) {
+	for (int word = first / 64; word <= last / 64; word++)
+		if (uint64_t bits = line[word] & WordMask(word, first, last))
+			return word * 64 + LowestBit(bits);
+	return -1;
+}
+
+// last set bit in [first, last] of a line of bits, or -1
+int FindLastBit(const uint64_t* line, int first, int last) {
+	for (int word = last / 64; word >= first / 64; word--)
+		if (uint64_t bits = line[word] & WordMask(word, first, last))
+			return word * 64 + HighestBit(bits);
+	return -1;
+}
+
+}
+
+Tile::ObstacleMap::ObstacleMap(Bits&& rows) : rows_(std::move(rows)), columns_(tile_size_ * words_per_line_) {
+	constexpr int block_size = tile_size_ / blocks_per_line_;
+
+	for (int y = 0; y < tile_size_; y++) {
+		for (int word = 0; word < words_per_line_; word++) {
+			uint64_t bits = rows_[y * words_per_line_ + word];
+			if (bits == 0)
+				continue;
+
+			LineSummary& row = row_summary_[y];
+			if (row.first == tile_size_)
+				row.first = word * 64 + LowestBit(bits);
+			row.last = word * 64 + HighestBit(bits);
+
+			// only iterates over set bits
+			for (; bits != 0; bits &= bits - 1) {
+				int x = word * 64 + LowestBit(bits);
+
+				columns_[x * words_per_line_ + y / 64] |= (uint64_t)1 << (y % 64);
+
+				LineSummary& column = column_summary_[x];
+				if (column.first == tile_size_)
+					column.first = y;
+				column.last = y;
+
+				blocks_ |= (uint64_t)1 << (y / block_size * blocks_per_line_ + x / block_size);
+			}
+		}
+	}
 }
 
 Tile::ObstacleMap::~ObstacleMap() {
 }
 
-void Tile::ObstacleMap::CheckLeftCollision(CollisionInfo& coll, const SDL2pp::Rect& localrect, const SDL2pp::Point& offset) const {
-	// This bit is interesting from the performance perspective
-	// here we need to get rightmost (and if there are multiple rightmost,
-	// bottommost of them) point for which obstacle mask is true
-	//
-	// We can either:
-	// - scan whole localrectangle from top to bottom and left to right and
-	//   return the best matching point
-	// - scan from the right, the from the bottom, and return the first
-	//   matching point
-	//
-	// The second way is, in theory, really unfriendly to cache prefetching
-	// (however modern CPUs may have optimization for backward scan as well),
-	// but it lets us stop the scan early in some cases (player close to a
-	// wall). The first way is cache-friendly, though it always scans the
-	// while localrectangle.
-	//
-	// There are other considerations, such as that we usually only need to
-	// scan a thin (in horizontal dilocalrection) stripe, so prefetching doesn't
-	// help us in any case.
-	//
-	// Anyway, I haven't done any tests and just chose a second variant
-	// intuitively, but someone could do some research. Also, there could
-	// be more clever data structure than a plain mask used to speed up
-	// collision detection even more. It's not a bottleneck for this to
-	// make sense though...
-	SDL2pp::Point point;
-	for (point.x = localrect.GetX2(); point.x >= localrect.x; point.x--) {
-		for (point.y = localrect.GetY2(); point.y >= localrect.y; point.y--) {
-			if (map_[point.x + tile_size_ * point.y]) {
-				coll.AddLeftCollision(point + offset);
-				return;
+bool Tile::ObstacleMap::MayIntersect(const SDL2pp::Rect& localrect) const {
+	constexpr int block_size = tile_size_ / blocks_per_line_;
+
+	const int bx1 = localrect.x / block_size, bx2 = localrect.GetX2() / block_size;
+	const int by1 = localrect.y / block_size, by2 = localrect.GetY2() / block_size;
+
+	const uint64_t line_mask = ((uint64_t)2 << bx2) - ((uint64_t)1 << bx1);
+
+	uint64_t mask = 0;
+	for (int by = by1; by <= by2; by++)
+		mask |= line_mask << (by * blocks_per_line_);
+
+	return blocks_ & mask;
+}
+
+bool Tile::ObstacleMap::FindRightmost(const SDL2pp::Rect& localrect, SDL2pp::Point& result) const {
+	// rightmost, and if there are multiple rightmost, bottommost of them
+	const int x1 = localrect.x, x2 = localrect.GetX2();
+	const int y1 = localrect.y, y2 = localrect.GetY2();
+
+	if (localrect.w <= localrect.h * 2) {
+		for (int x = x2; x >= x1; x--) {
+			const LineSummary& column = column_summary_[x];
+			if (column.first > y2 || column.last < y1)
+				continue;
+
+			int y = column.last <= y2 ? column.last : FindLastBit(&columns_[x * words_per_line_], std::max(y1, (int)column.first), y2);
+			if (y != -1) {
+				result = SDL2pp::Point(x, y);
+				return true;
 			}
 		}
+		return false;
+	}
+
+	bool found = false;
+	for (int y = y2; y >= y1 && !(found && result.x == x2); y--) {
+		const LineSummary& row = row_summary_[y];
+		if (row.first > x2 || row.last < x1)
+			continue;
+
+		int x = row.last <= x2 ? row.last : FindLastBit(&rows_[y * words_per_line_], std::max(x1, (int)row.first), x2);
+		if (x != -1 && (!found || x > result.x)) {
+			result = SDL2pp::Point(x, y);
+			found = true;
+		}
 	}
+	return found;
 }
 
-void Tile::ObstacleMap::CheckRightCollision(CollisionInfo& coll, const SDL2pp::Rect& localrect, const SDL2pp::Point& offset) const {
-	SDL2pp::Point point;
-	for (point.x = localrect.x; point.x <= localrect.GetX2(); point.x++) {
-		for (point.y = localrect.GetY2(); point.y >= localrect.y; point.y--) {
-			if (map_[point.x + tile_size_ * point.y]) {
-				coll.AddRightCollision(point + offset);
-				return;
+bool Tile::ObstacleMap::FindLeftmost(const SDL2pp::Rect& localrect, SDL2pp::Point& result) const {
+	// leftmost, and if there are multiple leftmost, bottommost of them
+	const int x1 = localrect.x, x2 = localrect.GetX2();
+	const int y1 = localrect.y, y2 = localrect.GetY2();
+
+	if (localrect.w <= localrect.h * 2) {
+		for (int x = x1; x <= x2; x++) {
+			const LineSummary& column = column_summary_[x];
+			if (column.first > y2 || column.last < y1)
+				continue;
+
+			int y = column.last <= y2 ? column.last : FindLastBit(&columns_[x * words_per_line_], std::max(y1, (int)column.first), y2);
+			if (y != -1) {
+				result = SDL2pp::Point(x, y);
+				return true;
 			}
 		}
+		return false;
 	}
+
+	bool found = false;
+	for (int y = y2; y >= y1 && !(found && result.x == x1); y--) {
+		const LineSummary& row = row_summary_[y];
+		if (row.first > x2 || row.last < x1)
+			continue;
+
+		int x = row.first >= x1 ? row.first : FindFirstBit(&rows_[y * words_per_line_], x1, std::min(x2, (int)row.last));
+		if (x != -1 && (!found || x < result.x)) {
+			result = SDL2pp::Point(x, y);
+			found = true;
+		}
+	}
+	return found;
 }
 
-void Tile::ObstacleMap::CheckTopCollision(CollisionInfo& coll, const SDL2pp::Rect& localrect, const SDL2pp::Point& offset) const {
-	SDL2pp::Point point;
-	for (point.y = localrect.GetY2(); point.y >= localrect.y; point.y--) {
-		for (point.x = localrect.x; point.x <= localrect.GetX2(); point.x++) {
-			if (map_[point.x + tile_size_ * point.y]) {
-				coll.AddTopCollision(point.y + offset.y);
-				return;
+bool Tile::ObstacleMap::FindBottommost(const SDL2pp::Rect& localrect, int& result) const {
+	const int x1 = localrect.x, x2 = localrect.GetX2();
+	const int y1 = localrect.y, y2 = localrect.GetY2();
+
+	if (localrect.h <= localrect.w * 2) {
+		for (int y = y2; y >= y1; y--) {
+			const LineSummary& row = row_summary_[y];
+			if (row.first > x2 || row.last < x1)
+				continue;
+
+			if (row.first >= x1 || row.last <= x2 || FindFirstBit(&rows_[y * words_per_line_], x1, x2) != -1) {
+				result = y;
+				return true;
 			}
 		}
+		return false;
+	}
+
+	bool found = false;
+	for (int x = x1; x <= x2 && !(found && result == y2); x++) {
+		const LineSummary& column = column_summary_[x];
+		if (column.first > y2 || column.last < y1)
+			continue;
+
+		int y = column.last <= y2 ? column.last : FindLastBit(&columns_[x * words_per_line_], std::max(y1, (int)column.first), y2);
+		if (y != -1 && (!found || y > result)) {
+			result = y;
+			found = true;
+		}
 	}
+	return found;
 }
 
-void Tile::ObstacleMap::CheckBottomCollision(CollisionInfo& coll, const SDL2pp::Rect& localrect, const SDL2pp::Point& offset) const {
-	SDL2pp::Point point;
-	for (point.y = localrect.y; point.y <= localrect.GetY2(); point.y++) {
-		for (point.x = localrect.x; point.x <= localrect.GetX2(); point.x++) {
-			if (map_[point.x + tile_size_ * point.y]) {
-				coll.AddBottomCollision(point.y + offset.y);
-				return;
+bool Tile::ObstacleMap::FindTopmost(const SDL2pp::Rect& localrect, int& result) const {
+	const int x1 = localrect.x, x2 = localrect.GetX2();
+	const int y1 = localrect.y, y2 = localrect.GetY2();
+
+	if (localrect.h <= localrect.w * 2) {
+		for (int y = y1; y <= y2; y++) {
+			const LineSummary& row = row_summary_[y];
+			if (row.first > x2 || row.last < x1)
+				continue;
+
+			if (row.first >= x1 || row.last <= x2 || FindFirstBit(&rows_[y * words_per_line_], x1, x2) != -1) {
+				result = y;
+				return true;
 			}
 		}
+		return false;
 	}
+
+	bool found = false;
+	for (int x = x1; x <= x2 && !(found && result == y1); x++) {
+		const LineSummary& column = column_summary_[x];
+		if (column.first > y2 || column.last < y1)
+			continue;
+
+		int y = column.first >= y1 ? column.first : FindFirstBit(&columns_[x * words_per_line_], y1, std::min(y2, (int)column.last));
+		if (y != -1 && (!found || y < result)) {
+			result = y;
+			found = true;
+		}
+	}
+	return found;
+}
+
+void Tile::ObstacleMap::CheckLeftCollision(CollisionInfo& coll, const SDL2pp::Rect& localrect, const SDL2pp::Point& offset) const {
+	// Rects which don't touch any non-empty 64x64 block are dropped
+	// right away; otherwise lines of the rect are either rejected or
+	// answered directly by per-line summaries, falling back to scanning
+	// the bitmap a word (64 pixels) at a time
+	SDL2pp::Point point;
+	if (MayIntersect(localrect) && FindRightmost(localrect, point))
+		coll.AddLeftCollision(point + offset);
+}
+
+void Tile::ObstacleMap::CheckRightCollision(CollisionInfo& coll, const SDL2pp::Rect& localrect, const SDL2pp::Point& offset) const {
+	SDL2pp::Point point;
+	if (MayIntersect(localrect) && FindLeftmost(localrect, point))
+		coll.AddRightCollision(point + offset);
+}
+
+void Tile::ObstacleMap::CheckTopCollision(CollisionInfo& coll, const SDL2pp::Rect& localrect, const SDL2pp::Point& offset) const {
+	int y;
+	if (MayIntersect(localrect) && FindBottommost(localrect, y))
+		coll.AddTopCollision(y + offset.y);
+}
+
+void Tile::ObstacleMap::CheckBottomCollision(CollisionInfo& coll, const SDL2pp::Rect& localrect, const SDL2pp::Point& offset) const {
+	int y;
+	if (MayIntersect(localrect) && FindTopmost(localrect, y))
+		coll.AddBottomCollision(y + offset.y);
+}
+
+size_t Tile::ObstacleMap::GetCpuBytes() const {
+	return sizeof(*this) + (rows_.capacity() + columns_.capacity()) * sizeof(uint64_t);
 }
@@ -0,0 +1,115 @@
+/*
+ * Copyright (C) 2015 Dmitry Marakasov <amdmi3@amdmi3.ru>
+ *
+ * This file is part of hoverboard-sdl.
+ *
+ * hoverboard-sdl is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * hoverboard-sdl is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with hoverboard-sdl.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "tile.hh"
+
+#include <algorithm>
+#include <cassert>
+#include <stdexcept>
+
+#include <SDL_surface.h>
+#include <SDL2pp/Surface.hh>
+
+constexpr size_t Tile::raw_header_size_;
+constexpr size_t Tile::raw_pixels_size_;
+
+std::vector<unsigned char> Tile::EncodeRaw(SDL2pp::Surface& surface) {
+	assert(surface.GetWidth() >= tile_size_ && surface.GetHeight() >= tile_size_);
+
+	SDL2pp::Surface::LockHandle lock = surface.Lock();
+
+	SDL_Palette* palette = surface.Get()->format->palette;
+	if (!palette || lock.GetFormat().BytesPerPixel != 1)
+		throw std::runtime_error("only paletted tiles are supported");
+
+	SDL_Color full_palette[256] = {};
+	std::copy(palette->colors, palette->colors + std::min(palette->ncolors, 256), full_palette);
+
+	const unsigned char* pixels = static_cast<const unsigned char*>(lock.GetPixels());
+
+	return EncodeRaw(Classify(full_palette, pixels, lock.GetPitch()), full_palette, pixels, lock.GetPitch());
+}
+
+std::vector<unsigned char> Tile::EncodeRaw(const Classification& cls, const SDL_Color* palette, const unsigned char* pixels, int pitch) {
+	std::vector<unsigned char> result;
+	result.reserve(raw_header_size_ + (cls.same_color ? 0 : raw_pixels_size_));
+
+	// header
+	if (cls.same_color && cls.color.a == 0)
+		result.push_back(RAW_VISUAL_NONE);
+	else if (cls.same_color)
+		result.push_back(RAW_VISUAL_SOLID);
+	else
+		result.push_back(RAW_VISUAL_PIXELS);
+
+	if (cls.same_obstacle && cls.obstacle)
+		result.push_back(RAW_OBSTACLE_SOLID);
+	else if (cls.same_obstacle)
+		result.push_back(RAW_OBSTACLE_NONE);
+	else
+		result.push_back(RAW_OBSTACLE_MAP);
+
+	result.insert(result.end(), { cls.color.r, cls.color.g, cls.color.b, cls.color.a });
+
+	if (cls.same_color)
+		return result;
+
+	// palette and indices
+	for (int i = 0; i < 256; i++)
+		result.insert(result.end(), { palette[i].r, palette[i].g, palette[i].b, palette[i].a });
+
+	for (int y = 0; y < tile_size_; y++)
+		result.insert(result.end(), pixels + y * pitch, pixels + y * pitch + tile_size_);
+
+	return result;
+}
+
+bool Tile::IsTrivialRaw(const unsigned char* header, Layers layers) {
+	return (header[0] != RAW_VISUAL_PIXELS || layers == Layers::OBSTACLES) && (header[1] != RAW_OBSTACLE_MAP || layers == Layers::VISUALS);
+}
+
+void Tile::InitFromRaw(const unsigned char* data, size_t size, Layers layers, const CancelCheck& cancel_check) {
+	if (size < raw_header_size_)
+		throw std::runtime_error("malformed pre-decoded tile");
+
+	Classification cls;
+	cls.same_color = data[0] != RAW_VISUAL_PIXELS;
+	cls.same_obstacle = data[1] != RAW_OBSTACLE_MAP;
+	cls.color = SDL_Color{ data[2], data[3], data[4], data[5] };
+	cls.obstacle = data[1] == RAW_OBSTACLE_SOLID;
+
+	if (data[0] == RAW_VISUAL_NONE)
+		cls.color.a = 0;
+
+	if (IsTrivialRaw(data, layers)) {
+		// no need to touch palette or pixels
+		InitFromIndexed(cls, nullptr, nullptr, 0, layers, cancel_check);
+		return;
+	}
+
+	if (data[0] != RAW_VISUAL_PIXELS || size < raw_header_size_ + raw_pixels_size_)
+		throw std::runtime_error("malformed pre-decoded tile");
+
+	SDL_Color palette[256];
+	const unsigned char* raw_palette = data + raw_header_size_;
+	for (int i = 0; i < 256; i++)
+		palette[i] = SDL_Color{ raw_palette[i * 4], raw_palette[i * 4 + 1], raw_palette[i * 4 + 2], raw_palette[i * 4 + 3] };
+
+	InitFromIndexed(cls, palette, raw_palette + 256 * 4, tile_size_, layers, cancel_check);
+}
@@ -19,28 +19,46 @@
 
 #include "tile.hh"
 
+#include <algorithm>
+
 #include <SDL_render.h>
 
 #include <SDL2pp/Renderer.hh>
 #include <SDL2pp/Texture.hh>
 
+#include "texturepool.hh"
+
 Tile::VisualData::~VisualData() {
 }
 
+size_t Tile::VisualData::GetTextureBytes() const {
+	return 0;
+}
+
 bool Tile::VisualData::NeedsUpgrade() const {
 	return false;
 }
 
-std::unique_ptr<Tile::TextureVisual> Tile::VisualData::Upgrade(SDL2pp::Renderer&) const {
+std::unique_ptr<Tile::TextureVisual> Tile::VisualData::Upgrade(TexturePool&) const {
 	return nullptr;
 }
 
+void Tile::VisualData::Downsample(int level, Uint32* output, int pitch) const {
+	const int size = tile_size_ >> level;
+	for (int y = 0; y < size; y++, output += pitch)
+		std::fill(output, output + size, 0);
+}
+
 Tile::NoVisual::~NoVisual() {
 }
 
 void Tile::NoVisual::Render(SDL2pp::Renderer&, const SDL2pp::Point&) {
 }
 
+size_t Tile::NoVisual::GetCpuBytes() const {
+	return sizeof(*this);
+}
+
 Tile::SolidVisual::SolidVisual(const SDL_Color& color) : color_(color) {
 }
 
@@ -52,7 +70,18 @@ void Tile::SolidVisual::Render(SDL2pp::Renderer& renderer, const SDL2pp::Point&
 	renderer.FillRect(SDL2pp::Rect(offset.x, offset.y, tile_size_, tile_size_));
 }
 
-Tile::PixelVisual::PixelVisual(PixelVisual::PixelData&& pixels) : pixels_(std::move(pixels)) {
+size_t Tile::SolidVisual::GetCpuBytes() const {
+	return sizeof(*this);
+}
+
+void Tile::SolidVisual::Downsample(int level, Uint32* output, int pitch) const {
+	const Uint32 color = (Uint32)color_.a << 24 | (Uint32)color_.r << 16 | (Uint32)color_.g << 8 | (Uint32)color_.b;
+	const int size = tile_size_ >> level;
+	for (int y = 0; y < size; y++, output += pitch)
+		std::fill(output, output + size, color);
+}
+
+Tile::PixelVisual::PixelVisual(IndexData&& indices, const Palette& palette) : indices_(std::move(indices)), palette_(palette) {
 }
 
 Tile::PixelVisual::~PixelVisual() {
@@ -62,21 +91,76 @@ bool Tile::PixelVisual::NeedsUpgrade() const {
 	return true;
 }
 
-std::unique_ptr<Tile::TextureVisual> Tile::PixelVisual::Upgrade(SDL2pp::Renderer& renderer) const {
-	return std::unique_ptr<Tile::TextureVisual>(new TextureVisual(renderer, pixels_));
+std::unique_ptr<Tile::TextureVisual> Tile::PixelVisual::Upgrade(TexturePool& pool) const {
+	return std::unique_ptr<Tile::TextureVisual>(new TextureVisual(pool, indices_, palette_));
 }
 
 void Tile::PixelVisual::Render(SDL2pp::Renderer&, const SDL2pp::Point&) {
 }
 
-Tile::TextureVisual::TextureVisual(SDL2pp::Renderer& renderer, const Tile::PixelVisual::PixelData& pixels)
-	: texture_(renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STATIC, tile_size_, tile_size_) {
-	texture_.Update(SDL2pp::NullOpt, pixels.data(), tile_size_ * 4);
+size_t Tile::PixelVisual::GetCpuBytes() const {
+	return sizeof(*this) + indices_.capacity();
+}
+
+void Tile::PixelVisual::Downsample(int level, Uint32* output, int pitch) const {
+	// box filter over 2^level x 2^level blocks
+	const int factor = 1 << level;
+	const int size = tile_size_ >> level;
+
+	for (int y = 0; y < size; y++, output += pitch) {
+		for (int x = 0; x < size; x++) {
+			Uint32 a = 0, r = 0, g = 0, b = 0;
+			for (int dy = 0; dy < factor; dy++) {
+				const unsigned char* index = indices_.data() + (y * factor + dy) * tile_size_ + x * factor;
+				for (int dx = 0; dx < factor; dx++) {
+					Uint32 color = palette_[index[dx]];
+					a += color >> 24;
+					r += (color >> 16) & 0xff;
+					g += (color >> 8) & 0xff;
+					b += color & 0xff;
+				}
+			}
+			output[x] = (a >> (level * 2)) << 24 | (r >> (level * 2)) << 16 | (g >> (level * 2)) << 8 | (b >> (level * 2));
+		}
+	}
+}
+
+Tile::TextureVisual::TextureVisual(TexturePool& pool, const PixelVisual::IndexData& indices, const PixelVisual::Palette& palette)
+	: pool_(pool),
+	  texture_(pool.Acquire()) {
+	const unsigned char* index = indices.data();
+
+	if (pool.GetAccess() == SDL_TEXTUREACCESS_STREAMING) {
+		// expand palette directly into texture memory
+		SDL2pp::Texture::LockHandle lock = texture_.Lock();
+		unsigned char* line = static_cast<unsigned char*>(lock.GetPixels());
+		for (int y = 0; y < tile_size_; y++, line += lock.GetPitch()) {
+			Uint32* pixel = reinterpret_cast<Uint32*>(line);
+			for (int x = 0; x < tile_size_; x++)
+				*pixel++ = palette[*index++];
+		}
+	} else {
+		// expand into scratch buffer, reused between uploads; these
+		// only happen on the main thread, so it's not guarded
+		static std::vector<Uint32> pixels(tile_size_ * tile_size_);
+		for (auto& pixel : pixels)
+			pixel = palette[*index++];
+		texture_.Update(SDL2pp::NullOpt, pixels.data(), tile_size_ * 4);
+	}
 }
 
 Tile::TextureVisual::~TextureVisual() {
+	pool_.Release(std::move(texture_));
 }
 
 void Tile::TextureVisual::Render(SDL2pp::Renderer& renderer, const SDL2pp::Point& offset) {
 	renderer.Copy(texture_, SDL2pp::NullOpt, offset);
 }
+
+size_t Tile::TextureVisual::GetCpuBytes() const {
+	return sizeof(*this);
+}
+
+size_t Tile::TextureVisual::GetTextureBytes() const {
+	return tile_size_ * tile_size_ * 4;
+}
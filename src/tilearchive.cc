@@ -0,0 +1,233 @@
+/*
+ * Copyright (C) 2015 Dmitry Marakasov <amdmi3@amdmi3.ru>
+ *
+ * This file is part of hoverboard-sdl.
+ *
+ * hoverboard-sdl is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * hoverboard-sdl is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with hoverboard-sdl.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "tilearchive.hh"
+
+#ifdef _WIN32
+#	include <iterator>
+#else
+#	include <sys/types.h>
+#	include <sys/stat.h>
+#	include <sys/mman.h>
+#	include <fcntl.h>
+#	include <unistd.h>
+#endif
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+
+constexpr char TileArchive::magic_[8];
+constexpr uint32_t TileArchive::version_;
+constexpr size_t TileArchive::header_size_;
+constexpr size_t TileArchive::index_entry_size_;
+
+namespace {
+
+uint32_t ReadUint32(const unsigned char* data) {
+	return (uint32_t)data[0] | (uint32_t)data[1] << 8 | (uint32_t)data[2] << 16 | (uint32_t)data[3] << 24;
+}
+
+int32_t ReadInt32(const unsigned char* data) {
+	return (int32_t)ReadUint32(data);
+}
+
+void WriteUint32(std::ostream& stream, uint32_t value) {
+	const char bytes[4] = { (char)(value & 0xff), (char)((value >> 8) & 0xff), (char)((value >> 16) & 0xff), (char)((value >> 24) & 0xff) };
+	stream.write(bytes, sizeof(bytes));
+}
+
+void WriteInt32(std::ostream& stream, int32_t value) {
+	WriteUint32(stream, (uint32_t)value);
+}
+
+}
+
+TileArchive::TileArchive(const std::string& path) {
+#ifdef _WIN32
+	// no mmap here, just read whole file into memory
+	std::ifstream file(path, std::ios::in | std::ios::binary);
+	if (!file.good())
+		return;
+
+	buffer_.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+
+	data_ = buffer_.data();
+	size_ = buffer_.size();
+#else
+	int fd = open(path.c_str(), O_RDONLY);
+	if (fd == -1)
+		return;
+
+	struct stat st;
+	if (fstat(fd, &st) != 0 || st.st_size == 0) {
+		close(fd);
+		return;
+	}
+
+	void* mapping = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd); // mapping stays valid after descriptor is closed
+
+	if (mapping == MAP_FAILED) {
+		std::cerr << "Warning: could not map tile archive " << path << ", falling back to loose tiles" << std::endl;
+		return;
+	}
+
+	data_ = static_cast<const unsigned char*>(mapping);
+	size_ = st.st_size;
+#endif
+
+	if (!Validate(path))
+		Close();
+}
+
+TileArchive::~TileArchive() {
+	Close();
+}
+
+bool TileArchive::Validate(const std::string& path) {
+	if (size_ < header_size_ || std::memcmp(data_, magic_, sizeof(magic_)) != 0) {
+		std::cerr << "Warning: " << path << " is not a tile archive, falling back to loose tiles" << std::endl;
+		return false;
+	}
+
+	uint32_t version = ReadUint32(data_ + 8);
+	if (version != version_) {
+		std::cerr << "Warning: tile archive " << path << " has incompatible version " << version << ", falling back to loose tiles" << std::endl;
+		return false;
+	}
+
+	format_ = static_cast<Format>(ReadUint32(data_ + 12));
+	count_ = ReadUint32(data_ + 16);
+
+	if (format_ != Format::PNG && format_ != Format::RAW) {
+		std::cerr << "Warning: tile archive " << path << " has unknown format, falling back to loose tiles" << std::endl;
+		return false;
+	}
+
+	if ((size_ - header_size_) / index_entry_size_ < count_) {
+		std::cerr << "Warning: tile archive " << path << " is truncated, falling back to loose tiles" << std::endl;
+		return false;
+	}
+
+	// check that all tiles lie within the file so we don't need to do it on each lookup
+	for (uint32_t i = 0; i < count_; i++) {
+		const unsigned char* entry = data_ + header_size_ + i * index_entry_size_;
+		uint32_t offset = ReadUint32(entry + 8);
+		uint32_t size = ReadUint32(entry + 12);
+
+		if (offset > size_ || size > size_ - offset) {
+			std::cerr << "Warning: tile archive " << path << " is truncated, falling back to loose tiles" << std::endl;
+			return false;
+		}
+	}
+
+	return true;
+}
+
+void TileArchive::Close() {
+#ifdef _WIN32
+	buffer_.clear();
+	buffer_.shrink_to_fit();
+#else
+	if (data_)
+		munmap(const_cast<unsigned char*>(data_), size_);
+#endif
+	data_ = nullptr;
+	size_ = 0;
+	count_ = 0;
+}
+
+bool TileArchive::IsOpen() const {
+	return data_ != nullptr;
+}
+
+TileArchive::Format TileArchive::GetFormat() const {
+	return format_;
+}
+
+size_t TileArchive::GetCount() const {
+	return count_;
+}
+
+SDL2pp::Optional<TileArchive::Blob> TileArchive::Find(const SDL2pp::Point& coords) const {
+	// binary search over the sorted index
+	uint32_t begin = 0, end = count_;
+	while (begin < end) {
+		uint32_t middle = begin + (end - begin) / 2;
+		const unsigned char* entry = data_ + header_size_ + middle * index_entry_size_;
+
+		int x = ReadInt32(entry);
+		int y = ReadInt32(entry + 4);
+
+		if (x == coords.x && y == coords.y)
+			return Blob{ data_ + ReadUint32(entry + 8), ReadUint32(entry + 12) };
+		else if (x < coords.x || (x == coords.x && y < coords.y))
+			begin = middle + 1;
+		else
+			end = middle;
+	}
+
+	return SDL2pp::NullOpt;
+}
+
+TileArchiveWriter::TileArchiveWriter(TileArchive::Format format) : format_(format) {
+}
+
+void TileArchiveWriter::AddTile(const SDL2pp::Point& coords, std::vector<unsigned char>&& data) {
+	entries_.emplace_back(Entry{ coords.x, coords.y, std::move(data) });
+}
+
+void TileArchiveWriter::Write(const std::string& path) {
+	std::sort(entries_.begin(), entries_.end(), [](const Entry& a, const Entry& b) {
+			return a.x < b.x || (a.x == b.x && a.y < b.y);
+		});
+
+	std::ofstream file(path, std::ios::out | std::ios::trunc | std::ios::binary);
+	if (!file.good())
+		throw std::runtime_error("cannot open " + path + " for writing");
+
+	// header
+	file.write(TileArchive::magic_, sizeof(TileArchive::magic_));
+	WriteUint32(file, TileArchive::version_);
+	WriteUint32(file, static_cast<uint32_t>(format_));
+	WriteUint32(file, entries_.size());
+
+	// index
+	size_t offset = TileArchive::header_size_ + entries_.size() * TileArchive::index_entry_size_;
+	for (auto& entry : entries_) {
+		if (offset + entry.data.size() > UINT32_MAX)
+			throw std::runtime_error("tile archive is too large");
+
+		WriteInt32(file, entry.x);
+		WriteInt32(file, entry.y);
+		WriteUint32(file, offset);
+		WriteUint32(file, entry.data.size());
+		offset += entry.data.size();
+	}
+
+	// payload
+	for (auto& entry : entries_)
+		file.write(reinterpret_cast<const char*>(entry.data.data()), entry.data.size());
+
+	if (!file.good())
+		throw std::runtime_error("cannot write " + path);
+}
@@ -0,0 +1,110 @@
+/*
+ * Copyright (C) 2015 Dmitry Marakasov <amdmi3@amdmi3.ru>
+ *
+ * This file is part of hoverboard-sdl.
+ *
+ * hoverboard-sdl is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * hoverboard-sdl is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with hoverboard-sdl.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef TILEARCHIVE_HH
+#define TILEARCHIVE_HH
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <SDL2pp/Optional.hh>
+#include <SDL2pp/Point.hh>
+
+// Single file archive containing all tiles
+//
+// All integers are little-endian. Layout:
+//
+//   header:  char[8] magic ("HBTILES\0")
+//            uint32  version
+//            uint32  payload format
+//            uint32  number of tiles
+//   index:   { int32 x, int32 y, uint32 offset, uint32 size } per tile,
+//            sorted by (x, y); offset is from the start of the file
+//   payload: tile data
+//
+// Tiles not present in the index don't exist.
+class TileArchive {
+public:
+	enum class Format : uint32_t {
+		PNG = 0,  // tiles are stored as is
+		RAW = 1,  // tiles are pre-decoded, see Tile::EncodeRaw
+	};
+
+	struct Blob {
+		const unsigned char* data;
+		size_t size;
+	};
+
+	static constexpr char magic_[8] = { 'H', 'B', 'T', 'I', 'L', 'E', 'S', '\0' };
+	static constexpr uint32_t version_ = 1;
+	static constexpr size_t header_size_ = 20;
+	static constexpr size_t index_entry_size_ = 16;
+
+private:
+	const unsigned char* data_ = nullptr;
+	size_t size_ = 0;
+
+	Format format_ = Format::PNG;
+	uint32_t count_ = 0;
+
+#ifdef _WIN32
+	std::vector<unsigned char> buffer_;
+#endif
+
+private:
+	bool Validate(const std::string& path);
+	void Close();
+
+public:
+	// Missing or broken archive is not an error: archive just
+	// stays closed and the caller is expected to fall back to
+	// loose tile files
+	TileArchive(const std::string& path);
+	~TileArchive();
+
+	TileArchive(const TileArchive&) = delete;
+	TileArchive& operator=(const TileArchive&) = delete;
+
+	bool IsOpen() const;
+	Format GetFormat() const;
+	size_t GetCount() const;
+
+	SDL2pp::Optional<Blob> Find(const SDL2pp::Point& coords) const;
+};
+
+class TileArchiveWriter {
+private:
+	struct Entry {
+		int x;
+		int y;
+		std::vector<unsigned char> data;
+	};
+
+	TileArchive::Format format_;
+	std::vector<Entry> entries_;
+
+public:
+	TileArchiveWriter(TileArchive::Format format);
+
+	void AddTile(const SDL2pp::Point& coords, std::vector<unsigned char>&& data);
+	void Write(const std::string& path);
+};
+
+#endif // TILEARCHIVE_HH
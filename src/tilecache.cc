@@ -19,193 +19,720 @@
 
 #include "tilecache.hh"
 
-#include <set>
+#include <algorithm>
 #include <cassert>
+#include <chrono>
 #include <cmath>
 
 #include "collision.hh"
+#include "rle.hh"
+
+static_assert(TileManifest::record_size_ == Tile::raw_header_size_, "tile manifest records must be pre-decoded tile headers");
+
+TileCache::TileCache(SDL2pp::Renderer& renderer, unsigned int nthreads, UploadMode upload_mode)
+	: renderer_(renderer),
+	  archive_(HOVERBOARD_TILEPACK),
+	  manifest_(HOVERBOARD_TILEMANIFEST),
+	  texture_pool_(renderer, SDL_PIXELFORMAT_ARGB8888, upload_mode == UploadMode::STREAMING ? SDL_TEXTUREACCESS_STREAMING : SDL_TEXTUREACCESS_STATIC, Tile::tile_size_, Tile::tile_size_, 16),
+	  scroll_buffer_(renderer, SDL_Color{255, 255, 255, 255}),
+	  cpu_budget_(64 << 20),
+	  texture_budget_(96 << 20),
+	  evicted_budget_(16 << 20),
+	  obstacle_budget_(16 << 20),
+	  level_budget_(48 << 20),
+	  finish_threads_(false) {
+	if (nthreads == 0)
+		nthreads = GetDefaultLoaderThreads();
+
+	for (unsigned int i = 0; i < nthreads; i++)
+		loader_threads_.emplace_back(&TileCache::LoaderThreadFunc, this);
+}
 
-TileCache::TileCache(SDL2pp::Renderer& renderer) : renderer_(renderer), cache_size_(64), finish_thread_(false) {
-	loader_thread_ = std::thread([this](){
-			std::unique_lock<std::mutex> lock(loader_queue_mutex_);
-			while (true) {
-				// wait on condvar until we should load something or must exit
-				loader_queue_condvar_.wait(lock, [&](){ return !loader_queue_.empty() || finish_thread_; } );
+TileCache::~TileCache() {
+	// signal worker threads to exit and join
+	finish_threads_ = true;
+	WakeLoaders();
+	for (auto& thread : loader_threads_)
+		thread.join();
+}
 
-				// finish the thread if requested
-				if (finish_thread_)
-					return;
+unsigned int TileCache::GetDefaultLoaderThreads() {
+	// leave one core for the main thread; hardware_concurrency()
+	// may also return 0 if it cannot determine number of cores
+	unsigned int ncores = std::thread::hardware_concurrency();
+	return ncores > 1 ? ncores - 1 : 1;
+}
 
-				assert(!loader_queue_.empty());
+void TileCache::LoaderThreadFunc() {
+	while (!finish_threads_) {
+		LoadChannel<SDL2pp::Point, Tile>::Ticket tile_ticket;
+		LoadChannel<LevelCoords, LevelTile>::Ticket level_ticket;
+
+		// regular tiles go first, as these are needed both for
+		// rendering and physics, then obstacle only tiles, and
+		// level tiles when there's nothing else to load
+		if (tile_loads_.Take(tile_ticket)) {
+			// note that we load Surface and not a texture, so
+			// we don't access OpenGL from non-main thread; loaded
+			// tile is converted to texture from main thread later
+			RunLoad(tile_loads_, std::move(tile_ticket), [this](const SDL2pp::Point& tilecoord, const Tile::CancelCheck& cancel_check) {
+					return LoadTile(tilecoord, cancel_check);
+				});
+		} else if (obstacle_loads_.Take(tile_ticket)) {
+			RunLoad(obstacle_loads_, std::move(tile_ticket), [this](const SDL2pp::Point& tilecoord, const Tile::CancelCheck& cancel_check) {
+					return LoadPartialTile(tilecoord, Tile::Layers::OBSTACLES, cancel_check);
+				});
+		} else if (level_loads_.Take(level_ticket)) {
+			RunLoad(level_loads_, std::move(level_ticket), [this](const LevelCoords& coords, const Tile::CancelCheck& cancel_check) {
+					return BuildLevelTile(coords.first, coords.second, cancel_check);
+				});
+		} else {
+			// wait on condvar until we should load something or must exit
+			std::unique_lock<std::mutex> lock(loader_mutex_);
+			loader_condvar_.wait(lock, [this](){ return tile_loads_.HasWork() || obstacle_loads_.HasWork() || level_loads_.HasWork() || finish_threads_; } );
+		}
+	}
+}
+
+template<class K, class T, class F>
+void TileCache::RunLoad(LoadChannel<K, T>& channel, typename LoadChannel<K, T>::Ticket&& ticket, F loader) {
+	auto start = std::chrono::steady_clock::now();
 
-				// take first tile from the queue and load its data
-				// note that we load Surface and not a texture, so
-				// we don't access OpenGL from non-main thread
-				SDL2pp::Point current_tile = loader_queue_.front();
-				currently_loading_ = current_tile;
+	std::unique_ptr<T> value;
+	try {
+		value.reset(new T(loader(ticket.GetKey(), [&channel, &ticket]() { return channel.IsStale(ticket); })));
+	} catch (Tile::LoadCancelled&) {
+	}
 
-				loader_queue_.pop_front();
+	float elapsed_ms = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+	channel.Complete(std::move(ticket), std::move(value), elapsed_ms);
+}
 
-				lock.unlock();
+void TileCache::WakeLoaders() {
+	// empty critical section makes sure that each loader is either
+	// not yet checking for work, or already waits for notification
+	{
+		std::lock_guard<std::mutex> lock(loader_mutex_);
+	}
+	loader_condvar_.notify_all();
+}
 
-				Tile tile(current_tile);
+float TileCache::GetUpgradeCost() const {
+	return upgrade_cost_us_;
+}
 
-				lock.lock();
+size_t TileCache::GetCpuBytes() const {
+	return cpu_bytes_;
+}
 
-				// save loaded tile into list so it's converted to
-				// texture from main thread later
-				loaded_tiles_.emplace(*currently_loading_, std::move(tile));
-				currently_loading_ = SDL2pp::NullOpt;
+size_t TileCache::GetTextureBytes() const {
+	return texture_bytes_;
+}
 
-				// wakeup main thread which may be waiting for us
-				if (loader_queue_.empty())
-					loader_queue_condvar_.notify_all();
-			}
-		});
+size_t TileCache::GetEvictedBytes() {
+	std::lock_guard<std::mutex> lock(evicted_tiles_mutex_);
+	return evicted_bytes_;
 }
 
-TileCache::~TileCache() {
-	// signal worked thread to exit and join
-	{
-		std::lock_guard<std::mutex> lock(loader_queue_mutex_);
-		finish_thread_ = true;
+size_t TileCache::GetObstacleBytes() const {
+	return obstacle_bytes_;
+}
+
+size_t TileCache::GetLevelBytes() const {
+	return level_bytes_;
+}
+
+TileCache::LoaderStats TileCache::GetLoaderStats() const {
+	LoaderStats stats;
+
+	for (auto* channel_stats : { &tile_loads_.GetStats(), &obstacle_loads_.GetStats() }) {
+		stats.loaded += channel_stats->loaded;
+		stats.cancelled += channel_stats->cancelled;
+		stats.cancelled_ms += channel_stats->cancelled_ms;
 	}
-	loader_queue_condvar_.notify_all();
-	loader_thread_.join();
+
+	stats.loaded += level_loads_.GetStats().loaded;
+	stats.cancelled += level_loads_.GetStats().cancelled;
+	stats.cancelled_ms += level_loads_.GetStats().cancelled_ms;
+
+	return stats;
 }
 
-void TileCache::SetCacheSize(size_t cache_size) {
-	cache_size_ = cache_size;
+const TexturePool::Stats& TileCache::GetTexturePoolStats() const {
+	return texture_pool_.GetStats();
 }
 
-void TileCache::UpdateCache(const SDL2pp::Rect& rect, int xprecache, int yprecache, LoadingProgressCallback loadingcb) {
-	// we only have one upgrade candidate per frame, as
-	// upgrading takes time and upgradeing multiple tiles
-	// may cause lags
-	SDL2pp::Optional<TileMap::iterator> upgrade_candidate;
-	std::set<SDL2pp::Point> seen_tiles;
+Tile TileCache::LoadTile(const SDL2pp::Point& tilecoord, const Tile::CancelCheck& cancel_check) {
+	// called from both main and loader threads
+	const unsigned char* record = manifest_.Find(tilecoord);
+	if (record && Tile::IsTrivialRaw(record))
+		return Tile(tilecoord, record, TileManifest::record_size_);
+
+	std::vector<unsigned char> compressed;
 
 	{
-		std::unique_lock<std::mutex> lock(loader_queue_mutex_);
-
-		// Calculate number of missing tiles for progress
-		int nmissing = 0;
-		int nloaded = 0;
-		ProcessTilesInRect(rect, [this, &nmissing](const SDL2pp::Point& tilecoord) {
-				auto tile_iter = tiles_.find(tilecoord);
-				if (tile_iter == tiles_.end())
-					nmissing++;
-			});
+		std::lock_guard<std::mutex> lock(evicted_tiles_mutex_);
+		if (auto* evicted = evicted_tiles_.Find(tilecoord)) {
+			evicted_bytes_ -= evicted->capacity();
+			compressed.swap(*evicted);
+			evicted_tiles_.Erase(tilecoord);
+		}
+	}
+
+	if (!compressed.empty())
+		return Tile(tilecoord, std::move(compressed));
+
+	return Tile(tilecoord, archive_, Tile::Layers::ALL, cancel_check);
+}
+
+Tile TileCache::LoadPartialTile(const SDL2pp::Point& tilecoord, Tile::Layers layers, const Tile::CancelCheck& cancel_check) {
+	// called from both main and loader threads
+	const unsigned char* record = manifest_.Find(tilecoord);
+	if (record && Tile::IsTrivialRaw(record, layers))
+		return Tile(tilecoord, record, TileManifest::record_size_, layers);
+
+	// second tier data is much cheaper to decode than a PNG; it's
+	// left in place, as the full tile may be needed later
+	std::vector<unsigned char> compressed;
+
+	{
+		std::lock_guard<std::mutex> lock(evicted_tiles_mutex_);
+		if (auto* evicted = evicted_tiles_.Find(tilecoord))
+			compressed = *evicted;
+	}
+
+	std::vector<unsigned char> raw;
+	if (!compressed.empty() && RleDecompress(compressed.data(), compressed.size(), raw))
+		return Tile(tilecoord, raw.data(), raw.size(), layers);
+
+	return Tile(tilecoord, archive_, layers, cancel_check);
+}
+
+LevelTile TileCache::BuildLevelTile(int level, const SDL2pp::Point& coords, const Tile::CancelCheck& cancel_check) {
+	// called from loader threads; each of the covered tiles is
+	// loaded (visuals only) and downsampled into its part of the
+	// level tile, which is cheap for trivial tiles as these come
+	// from the manifest
+	const int ntiles = 1 << level;
+	const int part_size = Tile::tile_size_ >> level;
 
-		if (nmissing != 0)
-			loadingcb(0, nmissing);
+	LevelTile::Pixels pixels(Tile::tile_size_ * Tile::tile_size_);
 
-		// clear queue, we'll for new one
-		loader_queue_.clear();
+	for (int y = 0; y < ntiles; y++) {
+		for (int x = 0; x < ntiles; x++) {
+			SDL2pp::Point tilecoord(coords.x * ntiles + x, coords.y * ntiles + y);
+			Uint32* part = pixels.data() + y * part_size * Tile::tile_size_ + x * part_size;
 
-		// flush downloader output
-		for (auto& tile : loaded_tiles_) {
-			tiles_.emplace(std::make_pair(tile.first, std::move(tile.second)));
-			seen_tiles.insert(tile.first);
+			if (cancel_check())
+				throw Tile::LoadCancelled();
+
+			LoadPartialTile(tilecoord, Tile::Layers::VISUALS, cancel_check).Downsample(level, part, Tile::tile_size_);
 		}
-		loaded_tiles_.clear();
-
-		//
-		// Synchronous phase. If we have anything to load here, it will
-		// cause lags, but there's no other option to draw the consistent
-		// image and to handle physics properly.
-		//
-
-		// first, if needed tile is currently loading, wait for this tile
-		if (currently_loading_ && Tile::RectForCoords(*currently_loading_).Intersects(rect))
-			loader_queue_condvar_.wait(lock, [&](){ return !currently_loading_; } );
-
-		// next, forcibly load and upgrade all visible tiles
-		ProcessTilesInRect(rect, [this, &seen_tiles, &loadingcb, &nloaded, &nmissing](const SDL2pp::Point& tilecoord) {
-				auto tile_iter = tiles_.find(tilecoord);
-				if (tile_iter == tiles_.end()) {
-					tile_iter = tiles_.emplace(tilecoord, Tile(tilecoord)).first;
-					nloaded++; // newly loaded tiles are counted here as well
-					loadingcb(std::min(nmissing, nloaded), nmissing);
-				}
-
-				if (tile_iter->second.NeedsUpgrade())
-					tile_iter->second.Upgrade(renderer_);
-
-				seen_tiles.insert(tile_iter->first);
-			});
+	}
+
+	return LevelTile(level, coords, std::move(pixels));
+}
+
+Tile* TileCache::AddTrivialTile(const SDL2pp::Point& tilecoord) {
+	// missing and solid color tiles are fully described by the
+	// manifest, so these are constructed in place and never
+	// go through loaders
+	const unsigned char* record = manifest_.Find(tilecoord);
+	if (!record || !Tile::IsTrivialRaw(record))
+		return nullptr;
+
+	return &AddTile(tilecoord, Tile(tilecoord, record, TileManifest::record_size_));
+}
+
+void TileCache::StoreEvictedTile(Tile& tile) {
+	if (!tile.HasCompressed())
+		return;
+
+	std::vector<unsigned char> compressed = tile.TakeCompressed();
+
+	std::lock_guard<std::mutex> lock(evicted_tiles_mutex_);
+
+	if (compressed.capacity() > evicted_budget_)
+		return;
+
+	evicted_bytes_ += compressed.capacity();
+	evicted_tiles_.Insert(tile.GetCoords(), std::move(compressed));
+
+	while (evicted_bytes_ > evicted_budget_) {
+		evicted_bytes_ -= evicted_tiles_.GetOldest()->capacity();
+		evicted_tiles_.PopOldest();
+	}
+}
+
+Tile* TileCache::FindTile(const SDL2pp::Point& tilecoord) {
+	if (tile_grid_.Contains(tilecoord))
+		return tile_grid_.Get(tilecoord);
+	return tiles_.Find(tilecoord);
+}
+
+Tile& TileCache::AddTile(const SDL2pp::Point& tilecoord, Tile&& tile) {
+	if (Tile* existing = tiles_.Touch(tilecoord))
+		return *existing;
+
+	content_registry_.Share(tile);
+
+	cpu_bytes_ += tile.GetCpuBytes();
+	texture_bytes_ += tile.GetTextureBytes();
+
+	Tile& inserted = tiles_.Insert(tilecoord, std::move(tile));
+	tile_grid_.Set(tilecoord, &inserted);
+	scroll_buffer_.Invalidate(inserted.GetRect());
 
-		//
-		// Async phase. Now we work with extended rectangle and form
-		// a new queue for downloader and a candidate for upgrade
-		//
-
-		// make new queue
-		ProcessTilesInRect(rect.GetExtension(xprecache, yprecache), [this, &upgrade_candidate](const SDL2pp::Point& tilecoord) {
-				auto tile_iter = tiles_.find(tilecoord);
-				if (tile_iter == tiles_.end()) {
-					if (!currently_loading_ || *currently_loading_ != tilecoord)
-						loader_queue_.emplace_back(tilecoord);
-				} else {
-					// XXX: use some more clever alg here? pick closest tile perhaps
-					if (tile_iter->second.NeedsUpgrade())
-						upgrade_candidate = tile_iter;
-				}
+	return inserted;
+}
+
+Tile& TileCache::AddObstacleTile(const SDL2pp::Point& tilecoord, Tile&& tile) {
+	if (Tile* existing = obstacle_tiles_.Touch(tilecoord))
+		return *existing;
+
+	obstacle_bytes_ += tile.GetCpuBytes();
+
+	return obstacle_tiles_.Insert(tilecoord, std::move(tile));
+}
+
+void TileCache::UpgradeTile(Tile& tile) {
+	cpu_bytes_ -= tile.GetCpuBytes();
+	texture_bytes_ -= tile.GetTextureBytes();
+
+	// another tile with the same content may already have it
+	// uploaded, in which case we just take its texture
+	content_registry_.Share(tile);
+	if (tile.NeedsUpgrade()) {
+		tile.Upgrade(texture_pool_);
+		content_registry_.Share(tile);
+	}
+
+	cpu_bytes_ += tile.GetCpuBytes();
+	texture_bytes_ += tile.GetTextureBytes();
+
+	scroll_buffer_.Invalidate(tile.GetRect());
+}
+
+void TileCache::UpgradeTilesWithinBudget(std::vector<std::pair<int, Tile*>>& candidates) {
+	std::sort(candidates.begin(), candidates.end(), [](const std::pair<int, Tile*>& a, const std::pair<int, Tile*>& b) {
+			return a.first < b.first;
+		});
+
+	auto start = std::chrono::steady_clock::now();
+
+	for (auto& candidate : candidates) {
+		auto now = std::chrono::steady_clock::now();
+		float elapsed_us = upgrade_spent_us_ + std::chrono::duration<float, std::micro>(now - start).count();
+
+		// always upgrade at least one tile per frame, so we make
+		// progress even if single upload doesn't fit into budget
+		if (&candidate != &candidates.front() && elapsed_us + upgrade_cost_us_ > upgrade_budget_us_)
+			break;
+
+		UpgradeTile(*candidate.second);
+
+		// track upload cost with exponential moving average
+		float cost_us = std::chrono::duration<float, std::micro>(std::chrono::steady_clock::now() - now).count();
+		upgrade_cost_us_ += (cost_us - upgrade_cost_us_) * 0.25f;
+	}
+
+	upgrade_spent_us_ += std::chrono::duration<float, std::micro>(std::chrono::steady_clock::now() - start).count();
+}
+
+void TileCache::EvictTiles(size_t nprotected) {
+	// First pass evicts only tiles which are heavy in terms of
+	// exceeded budget, e.g. when we're out of texture memory, only
+	// tiles with textures are evicted, and cheap solid color
+	// tiles stay. If that's not enough, second pass evicts
+	// whatever is least recently used
+	constexpr size_t heavy_tile_bytes = 4096;
+
+	for (bool only_heavy : { true, false }) {
+		tiles_.WalkOldest(nprotected, [&](Tile& tile) {
+				bool cpu_exceeded = cpu_bytes_ > cpu_budget_;
+				bool texture_exceeded = texture_bytes_ > texture_budget_;
+
+				if (!cpu_exceeded && !texture_exceeded)
+					return TileMap::Visit::STOP;
+
+				size_t tile_cpu_bytes = tile.GetCpuBytes();
+				size_t tile_texture_bytes = tile.GetTextureBytes();
+
+				if (only_heavy && !(cpu_exceeded && tile_cpu_bytes >= heavy_tile_bytes) && !(texture_exceeded && tile_texture_bytes >= heavy_tile_bytes))
+					return TileMap::Visit::KEEP;
+
+				cpu_bytes_ -= tile_cpu_bytes;
+				texture_bytes_ -= tile_texture_bytes;
+
+				StoreEvictedTile(tile);
+				tile_grid_.Set(tile.GetCoords(), nullptr);
+
+				return TileMap::Visit::EVICT;
 			});
 	}
 
-	// upgrade single tile
-	if (upgrade_candidate)
-		(*upgrade_candidate)->second.Upgrade(renderer_);
+	// textures kept in the pool count against the budget as well;
+	// these never cause tile eviction and are dropped instead, as
+	// they hold nothing visible
+	texture_pool_.Trim(texture_bytes_ < texture_budget_ ? texture_budget_ - texture_bytes_ : 0);
 
-	// ping loader to start crunching the new queue
-	loader_queue_condvar_.notify_all();
+	if (content_registry_.GetSize() > tiles_.Size())
+		content_registry_.Purge();
+}
 
-	// sort lru info
-	{
-		// this would not needed if we've used some sort of associative container with
-		// embedded linked list for LRU info; I'm too lazy to write one now
-		std::list<SDL2pp::Point> new_lru;
-		for (auto& tile : seen_tiles)
-			new_lru.push_back(tile);
-		for (auto& tile : lru_heavy_tiles_)
-			if (seen_tiles.find(tile) == seen_tiles.end())
-				new_lru.push_back(tile);
-
-		lru_heavy_tiles_.swap(new_lru);
+void TileCache::EvictObstacleTiles(size_t nprotected) {
+	obstacle_tiles_.WalkOldest(nprotected, [this](Tile& tile) {
+			if (obstacle_bytes_ <= obstacle_budget_)
+				return TileMap::Visit::STOP;
+
+			obstacle_bytes_ -= tile.GetCpuBytes();
+
+			return TileMap::Visit::EVICT;
+		});
+}
+
+void TileCache::EvictLevelTiles(int current_level, size_t nprotected) {
+	auto evict = [this](LevelTile& tile) {
+			if (level_bytes_ <= level_budget_)
+				return LevelTileMap::Visit::STOP;
+
+			level_bytes_ -= tile.GetCpuBytes() + tile.GetTextureBytes();
+
+			return LevelTileMap::Visit::EVICT;
+		};
+
+	// levels not being displayed go first
+	for (int level = 1; level <= LevelTile::max_level_; level++)
+		if (level != current_level)
+			level_tiles_[level - 1].WalkOldest(0, evict);
+
+	if (current_level > 0)
+		level_tiles_[current_level - 1].WalkOldest(nprotected, evict);
+}
+
+int TileCache::GetPrefetchPriority(const SDL2pp::Point& tilecoord, const SDL2pp::Rect& rect, const SDL2pp::Rect& projected_rect) {
+	// Lower is more urgent. Distance to the current camera rect
+	// makes closer tiles go first, and distance to where camera
+	// is expected to be makes tiles in the direction of travel go
+	// before the ones left behind, when tiles are otherwise
+	// equally close
+	SDL2pp::Rect tilerect = Tile::RectForCoords(tilecoord);
+
+	auto distance = [&tilerect](const SDL2pp::Rect& other) {
+		int dx = std::max({ 0, tilerect.x - other.GetX2(), other.x - tilerect.GetX2() });
+		int dy = std::max({ 0, tilerect.y - other.GetY2(), other.y - tilerect.GetY2() });
+		return dx + dy;
+	};
+
+	return distance(rect) + distance(projected_rect);
+}
+
+std::vector<SDL2pp::Point> TileCache::SortByPriority(std::vector<std::pair<int, SDL2pp::Point>>& prefetch) {
+	std::stable_sort(prefetch.begin(), prefetch.end(), [](const std::pair<int, SDL2pp::Point>& a, const std::pair<int, SDL2pp::Point>& b) {
+			return a.first < b.first;
+		});
+
+	std::vector<SDL2pp::Point> queue;
+	queue.reserve(prefetch.size());
+	for (auto& item : prefetch)
+		queue.emplace_back(item.second);
+
+	return queue;
+}
+
+void TileCache::UpdateCache(const SDL2pp::Rect& rect, int xprecache, int yprecache, const SDL2pp::Point& lookahead, LoadingProgressCallback loadingcb) {
+	// upgrading takes time and upgrading too many tiles may
+	// cause lags, so we collect candidates here and upgrade
+	// as many as fit into time budget later
+	std::vector<std::pair<int, Tile*>> upgrade_candidates;
+	size_t nvisible = 0;
+
+	// new frame, upgrade time budget is renewed
+	upgrade_spent_us_ = 0.0f;
+
+	prefetch_rect_ = rect.GetExtension(xprecache, yprecache);
+
+	// index covers whole prefetch area, so tiles are looked up
+	// in the map only as these get into it
+	SDL2pp::Point grid_start = Tile::CoordsForPoint(prefetch_rect_.GetTopLeft());
+	SDL2pp::Point grid_end = Tile::CoordsForPoint(prefetch_rect_.GetBottomRight());
+	tile_grid_.MoveTo(SDL2pp::Rect::FromCorners(grid_start, grid_end), [this](const SDL2pp::Point& tilecoord) {
+			return tiles_.Find(tilecoord);
+		});
+
+	// Calculate number of missing tiles for progress; trivial
+	// tiles are constructed right away and are not counted
+	int nmissing = 0;
+	int nloaded = 0;
+	ProcessTilesInRect(rect, [this, &nmissing, &nvisible](const SDL2pp::Point& tilecoord) {
+			if (!FindTile(tilecoord) && !AddTrivialTile(tilecoord))
+				nmissing++;
+			nvisible++;
+		});
+
+	if (nmissing != 0)
+		loadingcb(0, nmissing);
+
+	// clear queue, we'll form new one; tiles which are loading
+	// but are not going to be queued again are abandoned
+	auto wanted = [this](const SDL2pp::Point& tilecoord) {
+			return Tile::RectForCoords(tilecoord).Intersects(prefetch_rect_);
+		};
+
+	tile_loads_.Publish({}, wanted);
+
+	//
+	// Synchronous phase. If we have anything to load here, it will
+	// cause lags, but there's no other option to draw the consistent
+	// image and to handle physics properly.
+	//
+
+	// first, if any of needed tiles are currently loading, wait for
+	// them, flushing loaders output meanwhile; flushed tiles become
+	// most recently used
+	tile_loads_.WaitFor([&rect](const SDL2pp::Point& tilecoord) {
+			return Tile::RectForCoords(tilecoord).Intersects(rect);
+		}, [this](const SDL2pp::Point& tilecoord, Tile&& tile) {
+			AddTile(tilecoord, std::move(tile));
+		});
+
+	// next, forcibly load and upgrade all visible tiles,
+	// marking them as recently used
+	ProcessTilesInRect(rect, [this, &loadingcb, &nloaded, &nmissing](const SDL2pp::Point& tilecoord) {
+			Tile* tile = tiles_.Touch(tilecoord);
+			if (!tile) {
+				tile = &AddTile(tilecoord, LoadTile(tilecoord));
+				nloaded++; // newly loaded tiles are counted here as well
+				loadingcb(std::min(nmissing, nloaded), nmissing);
+			}
+
+			if (tile->NeedsUpgrade())
+				UpgradeTile(*tile);
+		});
+
+	//
+	// Async phase. Now we work with extended rectangle and form
+	// a new queue for downloader and candidates for upgrade
+	//
+
+	// make new queue, ordered by priority
+	SDL2pp::Rect projected_rect = rect + lookahead;
+	std::vector<std::pair<int, SDL2pp::Point>> prefetch;
+	bool added_trivial = false;
+
+	ProcessTilesInRect(prefetch_rect_, [&](const SDL2pp::Point& tilecoord) {
+			int priority = GetPrefetchPriority(tilecoord, rect, projected_rect);
+
+			Tile* tile = FindTile(tilecoord);
+			if (!tile && AddTrivialTile(tilecoord)) {
+				added_trivial = true;
+			} else if (!tile) {
+				if (!tile_loads_.IsInFlight(tilecoord))
+					prefetch.emplace_back(priority, tilecoord);
+			} else if (tile->NeedsUpgrade()) {
+				upgrade_candidates.emplace_back(priority, tile);
+			}
+		});
+
+	tile_loads_.Publish(SortByPriority(prefetch), wanted);
+
+	// ping loaders to start crunching the new queue
+	WakeLoaders();
+
+	// upgrade closest tiles within time budget
+	UpgradeTilesWithinBudget(upgrade_candidates);
+
+	// trivial tiles added above became most recently used, so
+	// touch visible tiles again for these to stay protected
+	if (added_trivial)
+		ProcessTilesInRect(rect, [this](const SDL2pp::Point& tilecoord) {
+				tiles_.Touch(tilecoord);
+			});
+
+	// finally, cleanup some old tiles; visible tiles are the most
+	// recently used ones at this point, and are never evicted
+	EvictTiles(nvisible);
+}
+
+void TileCache::UpdateObstacleCache(const SDL2pp::Rect& rect, int precache, const SDL2pp::Point& lookahead) {
+	size_t nprotected = 0;
+
+	// flush loaders output
+	obstacle_loads_.Flush([this](const SDL2pp::Point& tilecoord, Tile&& tile) {
+			AddObstacleTile(tilecoord, std::move(tile));
+		});
+
+	// tiles within regular prefetch area are skipped, as these
+	// are (or are going to be) loaded with obstacles anyway;
+	// the rest are marked as recently used, and are protected
+	// from eviction
+	const SDL2pp::Rect precache_rect = rect.GetExtension(precache);
+	auto wanted = [this, &precache_rect](const SDL2pp::Point& tilecoord) {
+			SDL2pp::Rect tilerect = Tile::RectForCoords(tilecoord);
+			return tilerect.Intersects(precache_rect) && !tilerect.Intersects(prefetch_rect_) && !FindTile(tilecoord);
+		};
+
+	SDL2pp::Rect projected_rect = rect + lookahead;
+	std::vector<std::pair<int, SDL2pp::Point>> prefetch;
+
+	ProcessTilesInRect(precache_rect, [&](const SDL2pp::Point& tilecoord) {
+			if (!wanted(tilecoord))
+				return;
+
+			if (obstacle_tiles_.Touch(tilecoord))
+				nprotected++;
+			else if (!obstacle_loads_.IsInFlight(tilecoord))
+				prefetch.emplace_back(GetPrefetchPriority(tilecoord, rect, projected_rect), tilecoord);
+		});
+
+	obstacle_loads_.Publish(SortByPriority(prefetch), wanted);
+
+	WakeLoaders();
+
+	EvictObstacleTiles(nprotected);
+}
+
+void TileCache::UpdateLevelCache(const SDL2pp::Rect& rect, float scale) {
+	const int level = LevelTile::LevelForScale(scale);
+
+	std::vector<LevelTile*> upgrade_candidates;
+	size_t nvisible = 0;
+
+	// flush loaders output
+	level_loads_.Flush([this](const LevelCoords& coords, LevelTile&& tile) {
+			LevelTileMap& tiles = level_tiles_[coords.first - 1];
+			if (!tiles.Touch(coords.second)) {
+				level_bytes_ += tile.GetCpuBytes() + tile.GetTextureBytes();
+				tiles.Insert(coords.second, std::move(tile));
+			}
+		});
+
+	// only tiles of current level within the ring are wanted
+	const int level_tile_size = Tile::tile_size_ << level;
+	const SDL2pp::Rect ring_rect = rect.GetExtension(level_tile_size);
+
+	std::vector<LevelCoords> queue;
+
+	if (level > 0) {
+		LevelTileMap& tiles = level_tiles_[level - 1];
+
+		// visible tiles first, then a ring of tiles around them;
+		// the ring goes into the queue and candidate list after
+		// all visible ones as it's processed in a separate pass
+		for (bool visible : { true, false }) {
+			ProcessLevelTilesInRect(level, visible ? rect : ring_rect, [&](const SDL2pp::Point& tilecoord) {
+					if (!visible && LevelTile::RectForCoords(level, tilecoord).Intersects(rect))
+						return;
+
+					LevelTile* tile = visible ? tiles.Touch(tilecoord) : tiles.Find(tilecoord);
+					if (visible)
+						nvisible++;
+
+					if (!tile) {
+						if (!level_loads_.IsInFlight(LevelCoords(level, tilecoord)))
+							queue.emplace_back(level, tilecoord);
+					} else if (tile->NeedsUpgrade()) {
+						upgrade_candidates.push_back(tile);
+					}
+				});
+		}
 	}
 
-	// finally, cleanup some old tiles
-	while (tiles_.size() > cache_size_) {
-		tiles_.erase(lru_heavy_tiles_.back());
-		lru_heavy_tiles_.pop_back();
+	level_loads_.Publish(std::move(queue), [level, &ring_rect](const LevelCoords& coords) {
+			return coords.first == level && LevelTile::RectForCoords(level, coords.second).Intersects(ring_rect);
+		});
+
+	WakeLoaders();
+
+	// upload within what's left of the per-frame time budget after
+	// regular tiles; at least one is uploaded if these took nothing
+	const bool budget_untouched = upgrade_spent_us_ == 0.0f;
+	auto start = std::chrono::steady_clock::now();
+
+	for (auto* tile : upgrade_candidates) {
+		auto now = std::chrono::steady_clock::now();
+		float elapsed_us = upgrade_spent_us_ + std::chrono::duration<float, std::micro>(now - start).count();
+
+		if (!(budget_untouched && tile == upgrade_candidates.front()) && elapsed_us + upgrade_cost_us_ > upgrade_budget_us_)
+			break;
+
+		level_bytes_ -= tile->GetCpuBytes() + tile->GetTextureBytes();
+		tile->Upgrade(texture_pool_);
+		level_bytes_ += tile->GetCpuBytes() + tile->GetTextureBytes();
 	}
+
+	upgrade_spent_us_ += std::chrono::duration<float, std::micro>(std::chrono::steady_clock::now() - start).count();
+
+	EvictLevelTiles(level, nvisible);
 }
 
-void TileCache::Render(const SDL2pp::Rect& rect) {
-	SDL2pp::Point start_tile = Tile::CoordsForPoint(SDL2pp::Point(rect.x, rect.y));
-	SDL2pp::Point end_tile = Tile::CoordsForPoint(SDL2pp::Point(rect.GetX2(), rect.GetY2()));
+void TileCache::RenderRegularTiles(const SDL2pp::Rect& area, const SDL2pp::Rect& viewport) {
+	SDL2pp::Point start_tile = Tile::CoordsForPoint(SDL2pp::Point(area.x, area.y));
+	SDL2pp::Point end_tile = Tile::CoordsForPoint(SDL2pp::Point(area.GetX2(), area.GetY2()));
 
-	// render all seen tiles
 	SDL2pp::Point tilecoord;
 	for (tilecoord.x = start_tile.x; tilecoord.x <= end_tile.x; tilecoord.x++) {
 		for (tilecoord.y = start_tile.y; tilecoord.y <= end_tile.y; tilecoord.y++) {
-			auto tileiter = tiles_.find(tilecoord);
-			if (tileiter != tiles_.end())
-				tileiter->second.Render(renderer_, rect);
+			if (Tile* tile = FindTile(tilecoord))
+				tile->Render(renderer_, viewport);
 		}
 	}
 }
 
-void TileCache::UpdateCollisions(CollisionInfo& collisions, const SDL2pp::Rect& rect, int distance) {
-	ProcessTilesInRect(rect.GetExtension(distance), [&](const SDL2pp::Point& tilecoord) {
-			auto tile = tiles_.find(tilecoord);
-			if (tile == tiles_.end()) // while we can skip not loaded tiles for rendering, we can't for physics
-				tile = tiles_.emplace(tilecoord, Tile(tilecoord)).first; // so load needed tile synchronously
+void TileCache::Render(const SDL2pp::Rect& rect, float scale) {
+	const int level = LevelTile::LevelForScale(scale);
+
+	// scroll buffer is only used when not scaled, as filtering
+	// would pick up unrelated pixels at its wraparound edges
+	if (scale == 1.0f && scroll_buffer_.Render(rect, [this](const SDL2pp::Rect& area, const SDL2pp::Rect& viewport) {
+				RenderRegularTiles(area, viewport);
+			}))
+		return;
+
+	// its contents would go stale while not used
+	scroll_buffer_.Invalidate();
+
+	if (level == 0) {
+		// render all seen tiles
+		RenderRegularTiles(rect, rect);
+		return;
+	}
+
+	// level tiles which are not ready yet are substituted with
+	// regular tiles, if these happen to be loaded
+	ProcessLevelTilesInRect(level, rect, [&](const SDL2pp::Point& tilecoord) {
+			LevelTile* tile = level_tiles_[level - 1].Find(tilecoord);
+			if (tile && !tile->NeedsUpgrade()) {
+				tile->Render(renderer_, rect);
+			} else if (auto area = LevelTile::RectForCoords(level, tilecoord).GetIntersection(rect)) {
+				RenderRegularTiles(*area, rect);
+			}
+		});
+}
+
+void TileCache::InvalidateRenderCache() {
+	scroll_buffer_.Invalidate();
+}
+
+void TileCache::UpdateCollisions(CollisionInfo& collisions, const SDL2pp::Rect& rect, const SDL2pp::Point& distance, const SDL2pp::Rect& visible_rect) {
+	ProcessTilesInRect(rect.GetExtension(distance.x, distance.y), [&](const SDL2pp::Point& tilecoord) {
+			Tile* tile = FindTile(tilecoord);
+			if (!tile)
+				tile = obstacle_tiles_.Touch(tilecoord);
+			if (!tile) {
+				// while we can skip not loaded tiles for rendering, we can't
+				// for physics, so load needed tiles synchronously; visible
+				// ones are loaded in full, as UpdateCache would load them again
+				if (Tile::RectForCoords(tilecoord).Intersects(visible_rect))
+					tile = &AddTile(tilecoord, LoadTile(tilecoord));
+				else
+					tile = &AddObstacleTile(tilecoord, LoadPartialTile(tilecoord, Tile::Layers::OBSTACLES));
+			}
 
-			tile->second.CheckLeftCollision(collisions, SDL2pp::Rect(rect.x - distance, rect.y, distance, rect.h));
-			tile->second.CheckRightCollision(collisions, SDL2pp::Rect(rect.x + rect.w, rect.y, distance, rect.h));
-			tile->second.CheckTopCollision(collisions, SDL2pp::Rect(rect.x, rect.y - distance, rect.w, distance));
-			tile->second.CheckBottomCollision(collisions, SDL2pp::Rect(rect.x, rect.y + rect.h, rect.w, distance));
+			tile->CheckLeftCollision(collisions, SDL2pp::Rect(rect.x - distance.x, rect.y, distance.x, rect.h));
+			tile->CheckRightCollision(collisions, SDL2pp::Rect(rect.x + rect.w, rect.y, distance.x, rect.h));
+			tile->CheckTopCollision(collisions, SDL2pp::Rect(rect.x, rect.y - distance.y, rect.w, distance.y));
+			tile->CheckBottomCollision(collisions, SDL2pp::Rect(rect.x, rect.y + rect.h, rect.w, distance.y));
 		});
 }
@@ -20,56 +20,200 @@
 #ifndef TILECACHE_HH
 #define TILECACHE_HH
 
-#include <map>
+#include <array>
+#include <atomic>
 #include <string>
 #include <condition_variable>
 #include <mutex>
-#include <list>
+#include <vector>
 #include <thread>
 #include <functional>
 
 #include <SDL2pp/Renderer.hh>
 
+#include "leveltile.hh"
+#include "loadchannel.hh"
+#include "lrumap.hh"
+#include "scrollbuffer.hh"
+#include "texturepool.hh"
 #include "tile.hh"
+#include "tilearchive.hh"
+#include "tilegrid.hh"
+#include "tilemanifest.hh"
 
 class Tile;
 class CollisionInfo;
 
 class TileCache {
+public:
+	// Either way, tiles are kept as palette indices until upload
+	enum class UploadMode {
+		STATIC,     // expand into scratch buffer and update static texture
+		STREAMING,  // expand directly into locked streaming texture
+	};
+
+	struct LoaderStats {
+		size_t loaded = 0;           // loads run to completion
+		size_t cancelled = 0;        // loads abandoned as no longer needed
+		float cancelled_ms = 0.0f;   // time spent on these before abandoning
+	};
+
 private:
-	typedef std::map<SDL2pp::Point, Tile> TileMap;
+	typedef LruMap<Tile> TileMap;
+	typedef LruMap<LevelTile> LevelTileMap;
+	typedef std::pair<int, SDL2pp::Point> LevelCoords;
 
 private:
 	SDL2pp::Renderer& renderer_;
 
+	TileArchive archive_;
+	TileManifest manifest_;
+
+	// must outlive tiles, which return their textures here
+	TexturePool texture_pool_;
+
 	TileMap tiles_;
-	size_t cache_size_;
-	std::list<SDL2pp::Point> lru_heavy_tiles_;
+	Tile::ContentRegistry content_registry_;
+
+	// index of tiles_ over the prefetch area, where most lookups go;
+	// follows the camera in UpdateCache
+	TileGrid<Tile> tile_grid_;
+
+	// regular tiles as rendered in previous frames, so only newly exposed
+	// and changed areas are redrawn when the view is not zoomed;
+	// it's filled with white, same as window background
+	ScrollBuffer scroll_buffer_;
+
+	// memory budgets and current usage; tiles which are cheap in
+	// terms of exceeded budget (such as solid color ones) are
+	// evicted last
+	size_t cpu_budget_;
+	size_t texture_budget_;
+	size_t cpu_bytes_ = 0;
+	size_t texture_bytes_ = 0;
+
+	// second tier: compressed data for recently evicted tiles
+	LruMap<std::vector<unsigned char>> evicted_tiles_;
+	size_t evicted_budget_;
+	size_t evicted_bytes_ = 0;
+	std::mutex evicted_tiles_mutex_;
+
+	// obstacle only tiles for physics where regular tiles are not
+	// loaded; these are much cheaper to load, and are prefetched
+	// further than regular tiles, outside of their prefetch area
+	TileMap obstacle_tiles_;
+	size_t obstacle_budget_;
+	size_t obstacle_bytes_ = 0;
+	SDL2pp::Rect prefetch_rect_;
+
+	// downsampled tiles for zoomed out views, one map per level
+	// starting with 1; these have a budget of their own, which
+	// covers both pixel data and textures
+	std::array<LevelTileMap, LevelTile::max_level_> level_tiles_;
+	size_t level_budget_;
+	size_t level_bytes_ = 0;
+
+	// texture upgrade scheduling: time per frame allowed to be spent
+	// on converting prefetched tiles into textures; visible tiles are
+	// always converted
+	float upgrade_budget_us_ = 2000.0f;
+	float upgrade_cost_us_ = 0.0f;  // estimated cost of single upgrade
+	float upgrade_spent_us_ = 0.0f; // of budget for the current frame
+
+	// background loaders; obstacle tiles are only loaded when there
+	// are no regular tiles to load, and level tiles when there's
+	// nothing else to load
+	std::vector<std::thread> loader_threads_;
+	LoadChannel<SDL2pp::Point, Tile> tile_loads_;
+	LoadChannel<SDL2pp::Point, Tile> obstacle_loads_;
+	LoadChannel<LevelCoords, LevelTile> level_loads_;
+
+	// only used by idle loaders to sleep until there's work
+	std::mutex loader_mutex_;
+	std::condition_variable loader_condvar_;
+
+	std::atomic<bool> finish_threads_;
+
+private:
+	void LoaderThreadFunc();
 
-	// background loader
-	std::thread loader_thread_;
-	std::list<SDL2pp::Point> loader_queue_;
-	std::map<SDL2pp::Point, Tile> loaded_tiles_;
-	SDL2pp::Optional<SDL2pp::Point> currently_loading_;
+	void WakeLoaders();
 
-	std::mutex loader_queue_mutex_;
-	std::condition_variable loader_queue_condvar_;
+	template<class K, class T, class F>
+	void RunLoad(LoadChannel<K, T>& channel, typename LoadChannel<K, T>::Ticket&& ticket, F loader);
 
-	bool finish_thread_;
+	Tile LoadTile(const SDL2pp::Point& tilecoord, const Tile::CancelCheck& cancel_check = Tile::CancelCheck());
+	Tile LoadPartialTile(const SDL2pp::Point& tilecoord, Tile::Layers layers, const Tile::CancelCheck& cancel_check = Tile::CancelCheck());
+	LevelTile BuildLevelTile(int level, const SDL2pp::Point& coords, const Tile::CancelCheck& cancel_check);
+	Tile* AddTrivialTile(const SDL2pp::Point& tilecoord);
+	void StoreEvictedTile(Tile& tile);
+
+	Tile* FindTile(const SDL2pp::Point& tilecoord);
+	Tile& AddTile(const SDL2pp::Point& tilecoord, Tile&& tile);
+	Tile& AddObstacleTile(const SDL2pp::Point& tilecoord, Tile&& tile);
+	void UpgradeTile(Tile& tile);
+	void UpgradeTilesWithinBudget(std::vector<std::pair<int, Tile*>>& candidates);
+	void EvictTiles(size_t nprotected);
+	void EvictObstacleTiles(size_t nprotected);
+	void EvictLevelTiles(int current_level, size_t nprotected);
+
+	void RenderRegularTiles(const SDL2pp::Rect& area, const SDL2pp::Rect& viewport);
+
+	static int GetPrefetchPriority(const SDL2pp::Point& tilecoord, const SDL2pp::Rect& rect, const SDL2pp::Rect& projected_rect);
+	static std::vector<SDL2pp::Point> SortByPriority(std::vector<std::pair<int, SDL2pp::Point>>& prefetch);
 
 public:
 	typedef std::function<void(int, int)> LoadingProgressCallback;
 
 public:
-	TileCache(SDL2pp::Renderer& renderer);
+	// nthreads == 0 means pick number of loader threads automatically
+	TileCache(SDL2pp::Renderer& renderer, unsigned int nthreads = 0, UploadMode upload_mode = UploadMode::STREAMING);
 	~TileCache();
 
-	void SetCacheSize(size_t cache_size);
+	static unsigned int GetDefaultLoaderThreads();
+
+	size_t GetCpuBytes() const;
+	size_t GetTextureBytes() const;
+	size_t GetEvictedBytes();
+	size_t GetObstacleBytes() const;
+	size_t GetLevelBytes() const;
+
+	float GetUpgradeCost() const;
+
+	const TexturePool::Stats& GetTexturePoolStats() const;
+	LoaderStats GetLoaderStats() const;
 
-	void UpdateCache(const SDL2pp::Rect& rect, int xprecache, int yprecache, LoadingProgressCallback loadingcb = LoadingProgressCallback());
-	void Render(const SDL2pp::Rect& rect);
+	// lookahead is expected camera movement in the near future,
+	// tiles in that direction are loaded and upgraded first
+	void UpdateCache(const SDL2pp::Rect& rect, int xprecache, int yprecache, const SDL2pp::Point& lookahead, LoadingProgressCallback loadingcb = LoadingProgressCallback());
 
-	void UpdateCollisions(CollisionInfo& collisions, const SDL2pp::Rect& rect, int distance);
+	// Obstacle only tiles are prefetched around rect (usually the
+	// player), where regular tiles are not going to be loaded by
+	// UpdateCache; should be called after it
+	void UpdateObstacleCache(const SDL2pp::Rect& rect, int precache, const SDL2pp::Point& lookahead);
+
+	// Level tiles are built asynchronously for the view rect at
+	// given camera scale, and until these are ready, the view is
+	// rendered from regular tiles, where these are loaded. Must be
+	// called each frame after UpdateCache, with scale 1.0 when not
+	// zoomed out; level tiles are uploaded within what's left of
+	// the frame's upgrade time budget
+	void UpdateLevelCache(const SDL2pp::Rect& rect, float scale);
+
+	// rect is in world coordinates; renderer is expected to have
+	// matching scale set
+	void Render(const SDL2pp::Rect& rect, float scale = 1.0f);
+
+	// should be called when render targets are lost
+	// (SDL_RENDER_TARGETS_RESET)
+	void InvalidateRenderCache();
+
+	// probes distance.x to the left and right of rect, and distance.y
+	// above and below it; uses regular tiles where loaded, obstacle
+	// only tiles otherwise; missing ones are loaded synchronously: in
+	// full if these intersect visible_rect (usually the camera),
+	// obstacles only otherwise
+	void UpdateCollisions(CollisionInfo& collisions, const SDL2pp::Rect& rect, const SDL2pp::Point& distance, const SDL2pp::Rect& visible_rect);
 
 	template<class T>
 	void ProcessTilesInRect(const SDL2pp::Rect& rect, T processor) {
@@ -81,6 +225,17 @@ public:
 			for (tilecoord.y = start_tile.y; tilecoord.y <= end_tile.y; tilecoord.y++)
 				processor(tilecoord);
 	}
+
+	template<class T>
+	static void ProcessLevelTilesInRect(int level, const SDL2pp::Rect& rect, T processor) {
+		SDL2pp::Point start_tile = LevelTile::CoordsForPoint(level, SDL2pp::Point(rect.x, rect.y));
+		SDL2pp::Point end_tile = LevelTile::CoordsForPoint(level, SDL2pp::Point(rect.GetX2(), rect.GetY2()));
+
+		SDL2pp::Point tilecoord;
+		for (tilecoord.x = start_tile.x; tilecoord.x <= end_tile.x; tilecoord.x++)
+			for (tilecoord.y = start_tile.y; tilecoord.y <= end_tile.y; tilecoord.y++)
+				processor(tilecoord);
+	}
 };
 
 #endif // TILECACHE_HH
@@ -0,0 +1,115 @@
+/*
+ * Copyright (C) 2015 Dmitry Marakasov <amdmi3@amdmi3.ru>
+ *
+ * This file is part of hoverboard-sdl.
+ *
+ * hoverboard-sdl is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * hoverboard-sdl is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with hoverboard-sdl.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef TILEGRID_HH
+#define TILEGRID_HH
+
+#include <algorithm>
+#include <vector>
+
+#include <SDL2pp/Point.hh>
+#include <SDL2pp/Rect.hh>
+
+// Dense index of items stored elsewhere (e.g. in LruMap), covering
+// a rectangular area of tile coordinates around the camera
+//
+// Slots are addressed by tile coordinates modulo grid size, so when
+// the area moves, slots which go out of it are reused for newly
+// exposed tiles in place, and only these are looked up again. Within
+// the area lookup is a single array access; outside of it, grid
+// knows nothing and the caller falls back to the storage.
+//
+// Grid holds plain pointers, so the owner must report every
+// insertion and removal of items within the area.
+template<class T>
+class TileGrid {
+private:
+	struct Slot {
+		T* item = nullptr;
+	};
+
+	int width_ = 0;
+	int height_ = 0;
+	SDL2pp::Rect area_;  // in tile coordinates, may be smaller than grid
+
+	std::vector<Slot> slots_;
+
+private:
+	static int Mod(int a, int b) {
+		int r = a % b;
+		return r < 0 ? r + b : r;
+	}
+
+	Slot& SlotFor(const SDL2pp::Point& coords) {
+		return slots_[Mod(coords.y, height_) * width_ + Mod(coords.x, width_)];
+	}
+
+public:
+	TileGrid() {
+	}
+
+	TileGrid(const TileGrid&) = delete;
+	TileGrid& operator=(const TileGrid&) = delete;
+
+	bool Contains(const SDL2pp::Point& coords) const {
+		return area_.Contains(coords);
+	}
+
+	// coords must be within the area
+	T* Get(const SDL2pp::Point& coords) {
+		return SlotFor(coords).item;
+	}
+
+	void Set(const SDL2pp::Point& coords, T* item) {
+		if (Contains(coords))
+			SlotFor(coords).item = item;
+	}
+
+	// Moves the grid to cover given area, which also sets grid
+	// size if the area doesn't fit; lookup(coords) is called
+	// for tiles which were not covered before
+	template<class F>
+	void MoveTo(const SDL2pp::Rect& area, F lookup) {
+		SDL2pp::Rect old_area = area_;
+
+		if (area.w > width_ || area.h > height_) {
+			// grow with some slack, so slightly bigger areas (such
+			// as when resizing the window) don't trigger it again
+			width_ = std::max(width_, area.w + 2);
+			height_ = std::max(height_, area.h + 2);
+			slots_.assign(width_ * height_, Slot());
+			old_area = SDL2pp::Rect();
+		}
+
+		area_ = area;
+
+		SDL2pp::Point coords;
+		for (coords.y = area.y; coords.y <= area.GetY2(); coords.y++) {
+			// rows which were fully covered before are skipped at once
+			if (coords.y >= old_area.y && coords.y <= old_area.GetY2() && area.x >= old_area.x && area.GetX2() <= old_area.GetX2())
+				continue;
+
+			for (coords.x = area.x; coords.x <= area.GetX2(); coords.x++)
+				if (!old_area.Contains(coords))
+					SlotFor(coords).item = lookup(coords);
+		}
+	}
+};
+
+#endif // TILEGRID_HH
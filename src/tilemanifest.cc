@@ -0,0 +1,160 @@
+/*
+ * Copyright (C) 2015 Dmitry Marakasov <amdmi3@amdmi3.ru>
+ *
+ * This file is part of hoverboard-sdl.
+ *
+ * hoverboard-sdl is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * hoverboard-sdl is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with hoverboard-sdl.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "tilemanifest.hh"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <limits>
+#include <stdexcept>
+
+constexpr char TileManifest::magic_[8];
+constexpr uint32_t TileManifest::version_;
+constexpr size_t TileManifest::header_size_;
+constexpr size_t TileManifest::record_size_;
+
+const TileManifest::Record TileManifest::missing_record_ = {};
+
+namespace {
+
+uint32_t ReadUint32(const unsigned char* data) {
+	return (uint32_t)data[0] | (uint32_t)data[1] << 8 | (uint32_t)data[2] << 16 | (uint32_t)data[3] << 24;
+}
+
+int32_t ReadInt32(const unsigned char* data) {
+	return (int32_t)ReadUint32(data);
+}
+
+void WriteUint32(std::ostream& stream, uint32_t value) {
+	const char bytes[4] = { (char)(value & 0xff), (char)((value >> 8) & 0xff), (char)((value >> 16) & 0xff), (char)((value >> 24) & 0xff) };
+	stream.write(bytes, sizeof(bytes));
+}
+
+void WriteInt32(std::ostream& stream, int32_t value) {
+	WriteUint32(stream, (uint32_t)value);
+}
+
+}
+
+TileManifest::TileManifest(const std::string& path) {
+	std::ifstream file(path, std::ios::in | std::ios::binary);
+	if (!file.good())
+		return;
+
+	std::vector<unsigned char> data{std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>()};
+
+	if (data.size() < header_size_ || std::memcmp(data.data(), magic_, sizeof(magic_)) != 0) {
+		std::cerr << "Warning: " << path << " is not a tile manifest, ignoring" << std::endl;
+		return;
+	}
+
+	uint32_t version = ReadUint32(data.data() + 8);
+	if (version != version_) {
+		std::cerr << "Warning: tile manifest " << path << " has incompatible version " << version << ", ignoring" << std::endl;
+		return;
+	}
+
+	uint32_t width = ReadUint32(data.data() + 20);
+	uint32_t height = ReadUint32(data.data() + 24);
+
+	if (width > (uint32_t)std::numeric_limits<int>::max() || height > (uint32_t)std::numeric_limits<int>::max() || (data.size() - header_size_) / record_size_ / std::max(width, 1u) < height) {
+		std::cerr << "Warning: tile manifest " << path << " is truncated, ignoring" << std::endl;
+		return;
+	}
+
+	x_ = ReadInt32(data.data() + 12);
+	y_ = ReadInt32(data.data() + 16);
+	width_ = (int)width;
+	height_ = (int)height;
+
+	records_.assign(data.begin() + header_size_, data.begin() + header_size_ + (size_t)width * height * record_size_);
+
+	open_ = true;
+}
+
+bool TileManifest::IsOpen() const {
+	return open_;
+}
+
+const unsigned char* TileManifest::Find(const SDL2pp::Point& coords) const {
+	if (!open_)
+		return nullptr;
+
+	// compare in 64 bit so grids near integer limits don't overflow
+	int64_t dx = (int64_t)coords.x - x_;
+	int64_t dy = (int64_t)coords.y - y_;
+
+	if (dx < 0 || dy < 0 || dx >= width_ || dy >= height_)
+		return missing_record_.data();
+
+	return records_.data() + (dx * height_ + dy) * record_size_;
+}
+
+void TileManifestWriter::AddTile(const SDL2pp::Point& coords, const unsigned char* record) {
+	Entry entry{ coords.x, coords.y, {} };
+	std::copy(record, record + TileManifest::record_size_, entry.record.begin());
+	entries_.emplace_back(entry);
+}
+
+void TileManifestWriter::Write(const std::string& path) {
+	// grid is the bounding box of all tiles, empty if there are none
+	int64_t x1 = 0, y1 = 0, x2 = -1, y2 = -1;
+	if (!entries_.empty()) {
+		x1 = x2 = entries_.front().x;
+		y1 = y2 = entries_.front().y;
+	}
+
+	for (auto& entry : entries_) {
+		x1 = std::min<int64_t>(x1, entry.x);
+		y1 = std::min<int64_t>(y1, entry.y);
+		x2 = std::max<int64_t>(x2, entry.x);
+		y2 = std::max<int64_t>(y2, entry.y);
+	}
+
+	const int64_t width = x2 - x1 + 1;
+	const int64_t height = y2 - y1 + 1;
+
+	if (width * height * TileManifest::record_size_ > UINT32_MAX)
+		throw std::runtime_error("tile manifest is too large");
+
+	std::vector<unsigned char> records(width * height * TileManifest::record_size_, 0);
+	for (auto& entry : entries_)
+		std::copy(entry.record.begin(), entry.record.end(), records.begin() + ((entry.x - x1) * height + (entry.y - y1)) * TileManifest::record_size_);
+
+	std::ofstream file(path, std::ios::out | std::ios::trunc | std::ios::binary);
+	if (!file.good())
+		throw std::runtime_error("cannot open " + path + " for writing");
+
+	// header
+	file.write(TileManifest::magic_, sizeof(TileManifest::magic_));
+	WriteUint32(file, TileManifest::version_);
+	WriteInt32(file, (int32_t)x1);
+	WriteInt32(file, (int32_t)y1);
+	WriteUint32(file, (uint32_t)width);
+	WriteUint32(file, (uint32_t)height);
+
+	// records
+	file.write(reinterpret_cast<const char*>(records.data()), records.size());
+
+	if (!file.good())
+		throw std::runtime_error("cannot write " + path);
+}
@@ -0,0 +1,96 @@
+/*
+ * Copyright (C) 2015 Dmitry Marakasov <amdmi3@amdmi3.ru>
+ *
+ * This file is part of hoverboard-sdl.
+ *
+ * hoverboard-sdl is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * hoverboard-sdl is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with hoverboard-sdl.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef TILEMANIFEST_HH
+#define TILEMANIFEST_HH
+
+#include <array>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <SDL2pp/Point.hh>
+
+// Summary of all tiles in the world, generated offline along with
+// the tile archive. It lets us construct trivial (missing and solid
+// color) tiles at once, without touching tile files or loaders
+//
+// All integers are little-endian. Layout:
+//
+//   header:  char[8] magic ("HBMANIF\0")
+//            uint32  version
+//            int32   x, y of the top left tile of the grid
+//            uint32  width, height of the grid in tiles
+//   records: record_size_ bytes per tile, column by column (e.g.
+//            x major, y minor); each record is a pre-decoded tile
+//            header (see Tile::EncodeRaw), all zeroes if tile is
+//            missing
+//
+// Tiles outside of the grid are missing.
+class TileManifest {
+public:
+	static constexpr char magic_[8] = { 'H', 'B', 'M', 'A', 'N', 'I', 'F', '\0' };
+	static constexpr uint32_t version_ = 1;
+	static constexpr size_t header_size_ = 28;
+	static constexpr size_t record_size_ = 6;
+
+	typedef std::array<unsigned char, record_size_> Record;
+
+private:
+	static const Record missing_record_;
+
+	int x_ = 0;
+	int y_ = 0;
+	int width_ = 0;
+	int height_ = 0;
+
+	std::vector<unsigned char> records_;
+
+	bool open_ = false;
+
+public:
+	// Missing or broken manifest is not an error: every tile
+	// is then treated as one which needs to be loaded
+	TileManifest(const std::string& path);
+
+	TileManifest(const TileManifest&) = delete;
+	TileManifest& operator=(const TileManifest&) = delete;
+
+	bool IsOpen() const;
+
+	// returns record for given tile, or nullptr if manifest is not open
+	const unsigned char* Find(const SDL2pp::Point& coords) const;
+};
+
+class TileManifestWriter {
+private:
+	struct Entry {
+		int x;
+		int y;
+		TileManifest::Record record;
+	};
+
+	std::vector<Entry> entries_;
+
+public:
+	void AddTile(const SDL2pp::Point& coords, const unsigned char* record);
+	void Write(const std::string& path);
+};
+
+#endif // TILEMANIFEST_HH